@@ -4,441 +4,6009 @@
 #include <Windows.h>
 #include <GL/gl.h>
 #include <GL/glu.h>
+#include <SDL_opengl.h> // Extension typedefs and constants beyond OpenGL 1.1
 #include <cstdlib>
 #include <ctime>
 #include <cmath> // For trigonometric functions
+#include <cstring>
+#include <cstdio>
+#include <cstddef>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <vector>
+#include <random>
+#include <string>
+#include <emmintrin.h> // SSE2, for the batched Kepler solver and the N-body force loop
 
 // Screen dimensions
 const int SCREEN_WIDTH = 1915;
 const int SCREEN_HEIGHT = 1030;
+const char* WINDOW_TITLE = "3D Planet and Moon with Atmospheres";
 
 // Zoom limits
 const float MIN_ZOOM = 2.1f;
+const float MIN_ZOOM_PRECISE_DEPTH = 1.2f; // Closest approach once the near plane is no longer at 1.0
 const float MAX_ZOOM = 20.0f;
 
+// Depth settings. Reverse-Z puts the float depth buffer's densest values at the far end, which
+// cancels the 1/z falloff of perspective depth, so the far plane can go to infinity.
+const float DEPTH_NEAR = 1.0e-4f;          // Near plane with reverse-Z or logarithmic depth (~640 m at Earth scale)
+const float DEPTH_LOG_FAR = 1.0e9f;        // Range the logarithmic fallback spreads its precision over
+const float DEPTH_CONVENTIONAL_NEAR = 1.0f;  // The original projection, kept for fixed-function rendering
+const float DEPTH_CONVENTIONAL_FAR = 1000.0f;
+
 // Timing constants
 const Uint32 RETURN_TO_ORIGINAL_DELAY = 2000; // 2 seconds delay for returning to original rotation
 Uint32 lastInteractionTime = 0;  // Track the last time the user interacted
+Uint32 sessionMilliseconds = 0;  // Input clock: real time, or the recorded frame times during --replay
 
-// Base class for celestial bodies
-class CelestialBody {
-public:
-    virtual void render() = 0;  // Polymorphic render method
-    virtual void update() = 0;  // Polymorphic update method
-    virtual ~CelestialBody() {} // Virtual destructor for proper cleanup
-};
+// HDR and bloom settings
+const float SUN_INTENSITY = 12.0f;        // Emissive multiplier so the sun lands well above 1.0 and blooms
+const float HDR_EXPOSURE = 1.0f;          // Exposure applied before tone mapping
+const float BLOOM_THRESHOLD = 1.0f;       // Only radiance above this feeds the bloom chain
+const float BLOOM_STRENGTH = 0.08f;       // How much of the blurred chain is added back to the scene
+const int BLOOM_MAX_MIPS = 6;             // Levels in the downsample/upsample chain
+const int BLOOM_MIN_MIPS = 2;             // The GPU budget never trims the chain below this
+const float BLOOM_GPU_BUDGET_MS = 0.6f;   // Bloom sheds levels when it costs more than this per frame
 
-// Forward declaration of Moon class
-class Moon;
+// Star field settings. Stars brighter than the reference magnitude get larger sprites,
+// fainter ones shrink to a pixel and then dim; anything past the limit is never drawn.
+const char* STAR_CATALOG_FILE = "stars.bin";
+const float STAR_MAGNITUDE_LIMIT = 7.5f;      // Roughly the naked-eye limit under a dark sky
+const float STAR_REFERENCE_MAGNITUDE = 0.0f;
+const float STAR_BASE_SIZE = 3.0f;            // Sprite diameter in pixels at the reference magnitude
+const float STAR_MAX_SIZE = 7.0f;
+const float STAR_INTENSITY = 2.0f;            // HDR brightness at the reference magnitude
 
-// Moon class (inherits from CelestialBody)
-class Moon : public CelestialBody {
-protected:
-    float orbitAngle;
-    float distance;
-    float size;
-    GLuint textureID, atmosphereTextureID;
+// Linked shader programs are cached here between runs, keyed by driver and source
+const char* PROGRAM_CACHE_DIRECTORY = "shader_cache";
 
-public:
-    Moon(float d, float s, GLuint texture, GLuint atmosphereTexture)
-        : distance(d), size(s), textureID(texture), atmosphereTextureID(atmosphereTexture), orbitAngle(0.0f) {}
+// Packed surface material: ocean mask and night lights share one RGTC2 (BC5) texture at a
+// fraction of the color map's resolution, one byte per texel before mipmaps
+const int MATERIAL_DOWNSAMPLE = 2;
+const char* OCEAN_MASK_FILE = "ocean_mask.png";     // Optional single-channel maps; derived when missing
+const char* NIGHT_LIGHTS_FILE = "night_lights.png";
 
-    virtual void render() override {
-        // The moon's position is now relative to the planet's coordinate system
-        glPushMatrix();
-        glRotatef(orbitAngle, 0.0f, 1.0f, 0.0f); // Orbit around the Y-axis
-        glTranslatef(distance, 0.0f, 0.0f);        // Move the moon out along the X-axis
+// Ring settings, in planet radii. Debris particles fill in the rings around a close camera,
+// thinning out with distance until the annulus texture alone carries the look.
+const float RING_INNER_RADIUS = 1.3f;
+const float RING_OUTER_RADIUS = 2.3f;
+const int RING_SEGMENTS = 256;             // Around the annulus
+const int RING_BANDS = 4;                  // Across it
+const int RING_DEBRIS_SECTORS = 128;       // Culling granularity
+const int RING_DEBRIS_PER_SECTOR = 512;
+const float RING_DEBRIS_RANGE = 0.6f;      // Distance at which debris density reaches zero
+const float RING_DEBRIS_THICKNESS = 0.01f;
 
-        // Render the moon
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        renderSphere(size, 30, 30);
+// Dynamic resolution settings
+const float DRS_TARGET_GPU_MS = 14.0f;    // GPU frame time to hold (leaves headroom inside a 60 Hz vsync interval)
+const float DRS_MIN_SCALE = 0.5f;         // Lowest internal resolution, per axis
+const float DRS_MAX_SCALE = 1.0f;
+const float DRS_MAX_STEP = 0.05f;         // Largest per-adjustment change in scale
 
-        // Render the moon's atmosphere
-        glPushMatrix();
-        glRotatef(orbitAngle * 0.5f, 0.0f, 1.0f, 0.0f); // Atmosphere rotates slower
-        glBindTexture(GL_TEXTURE_2D, atmosphereTextureID);
-        glColor4f(1.0f, 1.0f, 1.0f, 0.5f);
-        renderSphere(size + 0.05f, 30, 30);  // Slightly larger for atmosphere
-        glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
-        glPopMatrix();
+// Temporal anti-aliasing settings. The jitter cycle is long enough to cover every output pixel
+// when upsampling from TAA_UPSAMPLE_SCALE.
+const int TAA_JITTER_PHASES = 16;
+const float TAA_CURRENT_WEIGHT = 0.1f;    // Share of each new frame in the accumulated history
+const float TAA_UPSAMPLE_SCALE = 0.67f;   // Internal resolution per axis with temporal upsampling (~45% of the pixels)
 
-        glPopMatrix();
-    }
+// Reduced-resolution atmosphere settings. The shells are drawn after every opaque body into a
+// buffer at 1/2 or 1/4 resolution per axis and upsampled against scene depth.
+const int ATMOSPHERE_MAX_DOWNSAMPLE = 4;
+const int ATMOSPHERE_BENCHMARK_FRAMES = 120;  // Per zoom and factor; long enough for the GPU timer average to settle
+const float ATMOSPHERE_BENCHMARK_ZOOMS[] = { 1.2f, 1.5f, 2.1f, 3.0f, 5.0f, 10.0f, 20.0f };
 
-    virtual void update() override {
-        orbitAngle += 0.5f;  // Adjust speed as necessary
-        if (orbitAngle >= 360.0f) orbitAngle -= 360.0f;
-    }
+// Precision test scene (--precision-test). Scene units are planet radii, so 1 AU is the
+// Earth-Sun distance over the Earth's radius (149,597,871 km / 6,371 km).
+const double ASTRONOMICAL_UNIT = 23481.4;
+const float PRECISION_TEST_SUN_RADIUS = 109.2f;    // The Sun's radius in Earth radii
+const double PRECISION_TEST_MIN_ALTITUDE = 3.0e-4; // Closest approach, about 2 km above the surface
+const double PRECISION_TEST_MAX_ALTITUDE = 19.0;
+const double PRECISION_TEST_ZOOM_PERIOD = 30.0;    // Seconds for one dive to the surface and back out
 
-    static void renderSphere(float radius, int slices, int stacks) {
-        GLUquadric* quadric = gluNewQuadric();
-        gluQuadricTexture(quadric, GL_TRUE);
-        gluSphere(quadric, radius, slices, stacks);
-        gluDeleteQuadric(quadric);
-    }
-};
+// Simulation clock. The main thread advances the bodies in fixed steps at this rate (--sim-hz
+// overrides it) whatever the display rate; the render thread interpolates between steps.
+const double SIMULATION_HZ = 60.0;
+const double MAX_SIMULATION_CATCH_UP = 0.25;  // Seconds of backlog simulated per update; the rest is dropped
+const double SIMULATION_PASS_BUDGET_MS = 16.0; // Wall-clock time catch-up steps may take before input is polled again
+const double PLANET_ORBIT_RADIUS = 20.0;      // Semi-major axis; the precision test uses ASTRONOMICAL_UNIT
+const float PLANET_ORBIT_SPEED = 6.0f;        // Degrees per second of simulated time
+const double PLANET_ROTATION_PERIOD = 60.0;   // Seconds of simulated time per turn about its axis
 
-// Planet class
-class Planet : public CelestialBody {
-protected:
-    float rotationX, rotationY, zoom;
-    float passiveRotationSpeed;
-    GLuint textureID, atmosphereTextureID;
-    float radius, atmosphereRadius;
-    Moon* moon; // Pointer to the moon
+// Time warp: simulated seconds per real second, from 0 (paused) up in factors of ten. Analytic
+// bodies are evaluated at the absolute time, so any warp is exact for them; the N-body belt
+// takes as many stable substeps as its CPU budget allows and otherwise falls behind.
+const double TIME_WARP_MAX = 1.0e7;
 
-    // Separate rotation variables for user interaction and passive rotation
-    float userRotationX, userRotationY;
+// Keplerian orbits. Halley's method from Danby's starting guess converges to full double
+// precision in this many iterations for eccentricities up to about 0.95.
+const int KEPLER_ITERATIONS = 4;
+const double PLANET_ECCENTRICITY = 0.0167;             // The Earth's
+const double MOON_ECCENTRICITY = 0.0549;               // The Moon's
+const double MOON_INCLINATION = 5.145 * M_PI / 180.0;  // To the planet's orbital plane
+const double MOON_ORBIT_SPEED = 30.0 * M_PI / 180.0;   // Radians per second of simulated time
+const int KEPLER_BENCHMARK_ORBITS = 100000;
+const int KEPLER_BENCHMARK_RUNS = 200;
+const int BODY_BENCHMARK_BODIES = 100000;   // Default for --body-benchmark
+const int BODY_BENCHMARK_MOONS = 3;         // Moons per planet in the benchmark system
+const int BODY_BENCHMARK_RUNS = 100;
+const double EPHEMERIS_BUILD_SPAN = 3600.0;         // Default for --build-ephemeris, simulated seconds
+const int EPHEMERIS_BUILD_SEGMENTS_PER_ORBIT = 8;
+const Uint32 EPHEMERIS_BUILD_DEGREE = 11;
+const int EPHEMERIS_CHECK_SAMPLES = 100000;         // Random times compared against the orbits after writing
+const size_t ORBIT_GRAIN_PAIRS = 1024;      // Orbit pairs per job when propagating a large store
 
-    // Orbit variables
-    float orbitRadius;
-    float orbitAngle;
-    float orbitSpeed;
-public:
-    float positionX, positionZ; // Made public to access in main function
-
-    Planet(float r, float atmosphereR, GLuint texture, GLuint atmosphereTexture, Moon* m,
-        float orbitR, float orbitS)
-        : radius(r), atmosphereRadius(atmosphereR), textureID(texture), atmosphereTextureID(atmosphereTexture),
-        rotationX(0.0f), rotationY(0.0f), zoom(5.0f), passiveRotationSpeed(0.1f), moon(m),
-        userRotationX(0.0f), userRotationY(0.0f),
-        orbitRadius(orbitR), orbitAngle(0.0f), orbitSpeed(orbitS), positionX(orbitR), positionZ(0.0f)
-    {
-    }
+// Barnes-Hut N-body mode (--nbody N). The sun's mass is set so a circular orbit at the planet's
+// distance of 20 has the planet's angular speed: GM = (6 deg/s in radians)^2 * 20^3, G = 1.
+const double NBODY_SUN_MASS = 87.73;
+const double NBODY_BELT_MASS = 0.01;          // Total over all asteroids
+const double NBODY_BELT_INNER = 30.0, NBODY_BELT_OUTER = 60.0;
+const double NBODY_SOFTENING = 0.05;          // Plummer softening length, keeps close passes finite
+const double NBODY_DEFAULT_THETA = 0.7;       // Opening angle; --nbody-theta overrides
+const int NBODY_LEAF_SIZE = 16;               // Bodies a node holds before it splits
+const int NBODY_MORTON_BITS = 14;             // Per axis, so also the deepest tree level
+const int NBODY_INDEX_BITS = 22;              // Body index packed under the Morton code, so up to 4M bodies
+const int NBODY_PARALLEL_DEPTH = 2;           // Subtrees from this depth down are built in parallel
+const int NBODY_GRAIN = 256;                  // Bodies per parallel work item
+const int NBODY_GROUP_SIZE = 32;              // Bodies sharing one tree walk and interaction list
+const int NBODY_GROUP_GRAIN = 4;              // Groups per parallel work item in the force pass
+const double NBODY_REPORT_INTERVAL = 5.0;     // Seconds of real time between diagnostics
+const double NBODY_STEP_ACCURACY = 0.2;       // Substep as a fraction of sqrt(softening / largest acceleration)
+const double NBODY_MAX_STEP = 0.5;            // Longest substep, seconds of simulated time
+const double NBODY_FRAME_BUDGET_MS = 8.0;     // CPU time for the belt's substeps per main loop pass, over all its steps
 
-    // Getter methods to access protected members
-    float getRotationX() const { return rotationX; }
-    float getRotationY() const { return rotationY; }
-    float getZoom() const { return zoom; }
+// OpenGL extension entry points. opengl32.dll only exports OpenGL 1.1, so everything newer
+// is fetched through SDL_GL_GetProcAddress once the context exists (see loadGLExtensions).
+#define GL_EXTENSION_FUNCTIONS(X) \
+    X(PFNGLACTIVETEXTUREPROC, glActiveTexture) \
+    X(PFNGLCREATESHADERPROC, glCreateShader) \
+    X(PFNGLSHADERSOURCEPROC, glShaderSource) \
+    X(PFNGLCOMPILESHADERPROC, glCompileShader) \
+    X(PFNGLGETSHADERIVPROC, glGetShaderiv) \
+    X(PFNGLGETSHADERINFOLOGPROC, glGetShaderInfoLog) \
+    X(PFNGLDELETESHADERPROC, glDeleteShader) \
+    X(PFNGLCREATEPROGRAMPROC, glCreateProgram) \
+    X(PFNGLATTACHSHADERPROC, glAttachShader) \
+    X(PFNGLLINKPROGRAMPROC, glLinkProgram) \
+    X(PFNGLGETPROGRAMIVPROC, glGetProgramiv) \
+    X(PFNGLGETPROGRAMINFOLOGPROC, glGetProgramInfoLog) \
+    X(PFNGLDELETEPROGRAMPROC, glDeleteProgram) \
+    X(PFNGLUSEPROGRAMPROC, glUseProgram) \
+    X(PFNGLGETUNIFORMLOCATIONPROC, glGetUniformLocation) \
+    X(PFNGLUNIFORM1IPROC, glUniform1i) \
+    X(PFNGLUNIFORM1FPROC, glUniform1f) \
+    X(PFNGLUNIFORM2FPROC, glUniform2f) \
+    X(PFNGLUNIFORM2IPROC, glUniform2i) \
+    X(PFNGLUNIFORM4FPROC, glUniform4f) \
+    X(PFNGLGENFRAMEBUFFERSPROC, glGenFramebuffers) \
+    X(PFNGLDELETEFRAMEBUFFERSPROC, glDeleteFramebuffers) \
+    X(PFNGLBINDFRAMEBUFFERPROC, glBindFramebuffer) \
+    X(PFNGLFRAMEBUFFERTEXTURE2DPROC, glFramebufferTexture2D) \
+    X(PFNGLCHECKFRAMEBUFFERSTATUSPROC, glCheckFramebufferStatus) \
+    X(PFNGLGENRENDERBUFFERSPROC, glGenRenderbuffers) \
+    X(PFNGLDELETERENDERBUFFERSPROC, glDeleteRenderbuffers) \
+    X(PFNGLBINDRENDERBUFFERPROC, glBindRenderbuffer) \
+    X(PFNGLRENDERBUFFERSTORAGEPROC, glRenderbufferStorage) \
+    X(PFNGLFRAMEBUFFERRENDERBUFFERPROC, glFramebufferRenderbuffer) \
+    X(PFNGLGENQUERIESPROC, glGenQueries) \
+    X(PFNGLDELETEQUERIESPROC, glDeleteQueries) \
+    X(PFNGLQUERYCOUNTERPROC, glQueryCounter) \
+    X(PFNGLGETQUERYOBJECTIVPROC, glGetQueryObjectiv) \
+    X(PFNGLGETQUERYOBJECTUI64VPROC, glGetQueryObjectui64v) \
+    X(PFNGLGENBUFFERSPROC, glGenBuffers) \
+    X(PFNGLDELETEBUFFERSPROC, glDeleteBuffers) \
+    X(PFNGLBINDBUFFERPROC, glBindBuffer) \
+    X(PFNGLBINDBUFFERRANGEPROC, glBindBufferRange) \
+    X(PFNGLBUFFERDATAPROC, glBufferData) \
+    X(PFNGLBUFFERSUBDATAPROC, glBufferSubData) \
+    X(PFNGLMAPBUFFERRANGEPROC, glMapBufferRange) \
+    X(PFNGLUNMAPBUFFERPROC, glUnmapBuffer) \
+    X(PFNGLGETUNIFORMBLOCKINDEXPROC, glGetUniformBlockIndex) \
+    X(PFNGLUNIFORMBLOCKBINDINGPROC, glUniformBlockBinding) \
+    X(PFNGLFENCESYNCPROC, glFenceSync) \
+    X(PFNGLCLIENTWAITSYNCPROC, glClientWaitSync) \
+    X(PFNGLDELETESYNCPROC, glDeleteSync) \
+    X(PFNGLGENVERTEXARRAYSPROC, glGenVertexArrays) \
+    X(PFNGLDELETEVERTEXARRAYSPROC, glDeleteVertexArrays) \
+    X(PFNGLBINDVERTEXARRAYPROC, glBindVertexArray) \
+    X(PFNGLVERTEXATTRIBPOINTERPROC, glVertexAttribPointer) \
+    X(PFNGLENABLEVERTEXATTRIBARRAYPROC, glEnableVertexAttribArray) \
+    X(PFNGLVERTEXATTRIBDIVISORPROC, glVertexAttribDivisor) \
+    X(PFNGLUNIFORM1UIPROC, glUniform1ui) \
+    X(PFNGLUNIFORM1FVPROC, glUniform1fv) \
+    X(PFNGLUNIFORM3FPROC, glUniform3f) \
+    X(PFNGLUNIFORM4FVPROC, glUniform4fv) \
+    X(PFNGLUNIFORMMATRIX4FVPROC, glUniformMatrix4fv) \
+    X(PFNGLDRAWARRAYSINSTANCEDPROC, glDrawArraysInstanced) \
+    X(PFNGLDRAWBUFFERSPROC, glDrawBuffers) \
+    X(PFNGLBLITFRAMEBUFFERPROC, glBlitFramebuffer) \
+    X(PFNGLBLENDFUNCSEPARATEPROC, glBlendFuncSeparate) \
+    X(PFNGLBEGINQUERYPROC, glBeginQuery) \
+    X(PFNGLENDQUERYPROC, glEndQuery)
 
-    void setRotation(float rotX, float rotY) {
-        userRotationX = rotX;
-        userRotationY = rotY;
-    }
+// Entry points that newer contexts add on top of the 3.3 baseline. Missing ones only switch
+// off the feature that needs them.
+#define GL_OPTIONAL_EXTENSION_FUNCTIONS(X) \
+    X(PFNGLBUFFERSTORAGEPROC, glBufferStorage) \
+    X(PFNGLDISPATCHCOMPUTEPROC, glDispatchCompute) \
+    X(PFNGLMEMORYBARRIERPROC, glMemoryBarrier) \
+    X(PFNGLBINDBUFFERBASEPROC, glBindBufferBase) \
+    X(PFNGLMULTIDRAWELEMENTSINDIRECTPROC, glMultiDrawElementsIndirect) \
+    X(PFNGLDRAWARRAYSINDIRECTPROC, glDrawArraysIndirect) \
+    X(PFNGLCLIPCONTROLPROC, glClipControl) \
+    X(PFNGLGETPROGRAMBINARYPROC, glGetProgramBinary) \
+    X(PFNGLPROGRAMBINARYPROC, glProgramBinary) \
+    X(PFNGLPROGRAMPARAMETERIPROC, glProgramParameteri) \
+    X(PFNGLUNIFORM1DPROC, glUniform1d)
 
-    void setZoom(float z) { zoom = z; }
+#define DECLARE_GL_FUNCTION(type, name) type name = nullptr;
+GL_EXTENSION_FUNCTIONS(DECLARE_GL_FUNCTION)
+GL_OPTIONAL_EXTENSION_FUNCTIONS(DECLARE_GL_FUNCTION)
+#undef DECLARE_GL_FUNCTION
 
-    // Update the planet rotation passively and reset X-axis after interaction
-    virtual void update() override {
-        Uint32 currentTime = SDL_GetTicks();
-        // Passive rotation to the right (Y-axis)
-        rotationY += passiveRotationSpeed;
-        if (rotationY >= 360.0f) rotationY -= 360.0f;
+// What the context can do beyond the fixed-function baseline
+struct GLCapabilities {
+    int major = 1, minor = 1;
+    bool shaders = false;       // GLSL 3.30 compatibility programs
+    bool framebuffers = false;  // Framebuffer objects with float color attachments
+    bool timerQueries = false;  // GL_TIMESTAMP queries
+    bool postProcessing = false; // HDR target, bloom and tone mapping are usable
+    bool bufferStorage = false; // Persistently mapped buffers (GL 4.4 / ARB_buffer_storage)
+    bool gpuDriven = false;     // Compute shaders and multi-draw indirect (GL 4.3)
+    bool clipControl = false;   // [0, 1] clip-space depth (GL 4.5 / ARB_clip_control)
+    bool programBinary = false; // Linked programs can be saved and reloaded (GL 4.1 / ARB_get_program_binary)
+};
+GLCapabilities glCaps;
 
-        // Update orbit angle
-        orbitAngle += orbitSpeed;
-        if (orbitAngle >= 360.0f) orbitAngle -= 360.0f;
+// How scene depth is stored. Reverse-Z needs clip control; without it, shaders write a
+// logarithmic depth themselves; without shaders the original 1..1000 projection stays.
+enum DepthMode {
+    DEPTH_CONVENTIONAL,
+    DEPTH_LOGARITHMIC,
+    DEPTH_REVERSE_Z
+};
+DepthMode depthMode = DEPTH_CONVENTIONAL; // Chosen once before the render thread starts
+std::string shaderDefines;                // Inserted after each shader's #version line
 
-        // Update position
-        positionX = orbitRadius * cosf(orbitAngle * M_PI / 180.0f);
-        positionZ = orbitRadius * sinf(orbitAngle * M_PI / 180.0f);
+// Non-blocking GPU timer built on GL_TIMESTAMP queries. Timestamps (unlike GL_TIME_ELAPSED)
+// can be nested and overlapped freely. Each frame writes a fresh slot of the ring and reads
+// back the oldest one, which has had GPU_TIMER_LATENCY frames to complete, so the CPU never waits.
+const int GPU_TIMER_LATENCY = 4;
 
-        // Reset X-axis to 0 after 2 seconds of no interaction
-        if (currentTime - lastInteractionTime >= RETURN_TO_ORIGINAL_DELAY && userRotationX != 0.0f) {
-            if (userRotationX > 0.0f) userRotationX -= 0.5f;
-            if (userRotationX < 0.0f) userRotationX += 0.5f;
-            if (fabs(userRotationX) < 0.5f) userRotationX = 0.0f; // Snap to zero
-        }
+class GpuTimer {
+protected:
+    GLuint queries[GPU_TIMER_LATENCY][2];
+    bool issued[GPU_TIMER_LATENCY];
+    int frame;
+    float lastMs, averageMs;
 
-        // Update moon
-        if (moon) {
-            moon->update();
+public:
+    GpuTimer() : frame(0), lastMs(0.0f), averageMs(0.0f) {
+        for (int i = 0; i < GPU_TIMER_LATENCY; ++i) {
+            queries[i][0] = queries[i][1] = 0;
+            issued[i] = false;
         }
     }
 
-    virtual void render() override {
-        // Render the planet
-        glPushMatrix();
-        glTranslatef(positionX, 0.0f, positionZ);
-        glRotatef(userRotationX, 1.0f, 0.0f, 0.0f); // User-controlled rotation
-        glRotatef(userRotationY, 0.0f, 1.0f, 0.0f); // User-controlled rotation
-        glRotatef(rotationY, 0.0f, 1.0f, 0.0f);     // Passive rotation
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        renderSphere(radius, 40, 40);
-
-        // Render the atmosphere
-        glPushMatrix();
-        glRotatef(rotationY + 5.0f, 0.0f, 1.0f, 0.0f);  // Atmosphere rotates based on passive rotation
-        glBindTexture(GL_TEXTURE_2D, atmosphereTextureID);
-        glColor4f(1.0f, 1.0f, 1.0f, 0.5f);  // Set translucency
-        renderSphere(atmosphereRadius, 40, 40);
-        glColor4f(1.0f, 1.0f, 1.0f, 1.0f);  // Reset opacity
-        glPopMatrix();
+    void init() {
+        if (!glCaps.timerQueries) return;
+        glGenQueries(GPU_TIMER_LATENCY * 2, &queries[0][0]);
+    }
 
-        // Render the moon relative to the planet
-        if (moon) {
-            moon->render();
-        }
+    void release() {
+        if (queries[0][0]) glDeleteQueries(GPU_TIMER_LATENCY * 2, &queries[0][0]);
+        queries[0][0] = 0;
+    }
 
-        glPopMatrix();
+    void begin() {
+        if (!queries[0][0]) return;
+        int slot = frame % GPU_TIMER_LATENCY;
+        // Collect the result this slot held before reusing it
+        if (issued[slot]) {
+            GLint available = 0;
+            glGetQueryObjectiv(queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint64 start = 0, end = 0;
+                glGetQueryObjectui64v(queries[slot][0], GL_QUERY_RESULT, &start);
+                glGetQueryObjectui64v(queries[slot][1], GL_QUERY_RESULT, &end);
+                lastMs = (float)((end - start) / 1.0e6);
+                averageMs = averageMs * 0.9f + lastMs * 0.1f; // Smooth out per-frame noise
+            }
+        }
+        glQueryCounter(queries[slot][0], GL_TIMESTAMP);
     }
 
-    static void renderSphere(float radius, int slices, int stacks) {
-        glPushMatrix();
-        glRotatef(90.0f, 1.0f, 0.0f, 0.0f);
-        GLUquadric* quadric = gluNewQuadric();
-        gluQuadricTexture(quadric, GL_TRUE);
-        gluSphere(quadric, radius, slices, stacks);
-        gluDeleteQuadric(quadric);
-        glPopMatrix();
+    void end() {
+        if (!queries[0][0]) return;
+        int slot = frame % GPU_TIMER_LATENCY;
+        glQueryCounter(queries[slot][1], GL_TIMESTAMP);
+        issued[slot] = true;
+        ++frame;
     }
+
+    float getLastMs() const { return lastMs; }
+    float getAverageMs() const { return averageMs; }
+};
+
+// Render passes timed by the GPU profiler
+enum GpuPass {
+    GPU_PASS_STARS,
+    GPU_PASS_SUN,
+    GPU_PASS_PLANET,
+    GPU_PASS_ATMOSPHERE,
+    GPU_PASS_MOON,
+    GPU_PASS_RINGS,
+    GPU_PASS_DEBRIS,
+    GPU_PASS_BODIES,
+    GPU_PASS_TAA,
+    GPU_PASS_BLOOM,
+    GPU_PASS_TONEMAP,
+    GPU_PASS_OVERLAY,
+    GPU_PASS_COUNT
 };
 
-// Sun class (inherits from CelestialBody)
-class Sun : public CelestialBody {
+// Per-pass GPU timing for the render thread. Each pass owns a GpuTimer, so results arrive
+// GPU_TIMER_LATENCY frames late and reading them never stalls the CPU. Passes that were skipped
+// recently (bloom switched off, say) report zero instead of their last stale value.
+class GpuProfiler {
 protected:
-    float radius;
-    GLuint textureID;
+    GpuTimer frameTimer;
+    GpuTimer passTimers[GPU_PASS_COUNT];
+    Uint64 frameIndex;
+    Uint64 lastUsedFrame[GPU_PASS_COUNT];
 
 public:
-    Sun(float r, GLuint texture)
-        : radius(r), textureID(texture) {}
+    GpuProfiler() : frameIndex(0) {
+        for (int i = 0; i < GPU_PASS_COUNT; ++i) lastUsedFrame[i] = 0;
+    }
 
-    virtual void render() override {
-        glPushMatrix();
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        Planet::renderSphere(radius, 40, 40);
-        glPopMatrix();
+    void init() {
+        frameTimer.init();
+        for (int i = 0; i < GPU_PASS_COUNT; ++i) passTimers[i].init();
     }
 
-    virtual void update() override {
-        // Sun doesn't need to update
+    void release() {
+        frameTimer.release();
+        for (int i = 0; i < GPU_PASS_COUNT; ++i) passTimers[i].release();
     }
-};
 
-// Mouse controls and variables
-float sphereRotationY = 0.0f;
-float sphereRotationX = 0.0f;
-bool dragging = false;
-int lastMouseX, lastMouseY;
+    void beginFrame() { frameTimer.begin(); }
+    void endFrame() {
+        frameTimer.end();
+        ++frameIndex;
+    }
 
-// Function prototypes
-void initSDL(SDL_Window*& window, SDL_GLContext& context);
-void initOpenGL();
-GLuint loadTexture(const char* filename);
-void handleInput(SDL_Event& event, bool& running, Planet& planet);
-void cleanup(SDL_Window* window, SDL_GLContext context);
+    void begin(GpuPass pass) {
+        passTimers[pass].begin();
+        lastUsedFrame[pass] = frameIndex + 1;
+    }
+    void end(GpuPass pass) { passTimers[pass].end(); }
 
-// Main function
-int main(int argc, char* argv[]) {
-    SDL_Window* window = nullptr;
-    SDL_GLContext context;
+    bool isActive(GpuPass pass) const {
+        return lastUsedFrame[pass] != 0 && frameIndex < lastUsedFrame[pass] + GPU_TIMER_LATENCY * 2;
+    }
 
-    // Initialize SDL and OpenGL
-    initSDL(window, context);
-    initOpenGL();
+    float getPassMs(GpuPass pass) const { return isActive(pass) ? passTimers[pass].getLastMs() : 0.0f; }
+    float getPassAverageMs(GpuPass pass) const { return isActive(pass) ? passTimers[pass].getAverageMs() : 0.0f; }
+    float getFrameMs() const { return frameTimer.getLastMs(); }
+    float getFrameAverageMs() const { return frameTimer.getAverageMs(); }
 
-    // Initialize SDL_image
-    if (!(IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG) & (IMG_INIT_PNG | IMG_INIT_JPG))) {
-        std::cerr << "SDL_image could not initialize! IMG_Error: " << IMG_GetError() << std::endl;
-        cleanup(window, context);
-        return 1;
+    static const char* getPassName(GpuPass pass) {
+        static const char* names[GPU_PASS_COUNT] = { "STARS", "SUN", "PLANET", "ATMOSPHERE", "MOON", "RINGS", "DEBRIS", "BODIES", "TAA", "BLOOM", "TONEMAP", "OVERLAY" };
+        return names[pass];
     }
+};
 
-    // Load textures
-    GLuint planetTexture = loadTexture("map2.png");
-    GLuint planetAtmosphereTexture = loadTexture("clouds.png");
-    GLuint moonTexture = loadTexture("moon.jpg");
-    GLuint moonAtmosphereTexture = loadTexture("clouds.png");
-    GLuint sunTexture = loadTexture("map2.png"); // Add sun texture
+GpuProfiler gpuProfiler; // Render thread only
 
-    // Create moon object first with realistic distance and size
-    Moon* moon = new Moon(5.0f, 0.27f, moonTexture, moonAtmosphereTexture); // Distance increased to 5.0f and size to 0.27f
+// Floating-point scene target and the bloom mip chain
+struct HdrTarget {
+    GLuint framebuffer = 0;
+    GLuint colorTexture = 0;   // RGBA16F scene radiance
+    GLuint depthTexture = 0;   // 32-bit float, sampled by the atmosphere upsample
+    int width = 0, height = 0;
+};
 
-    // Create planet object and pass the moon to it, with orbit around the sun
-    Planet planet(1.0f, 1.05f, planetTexture, planetAtmosphereTexture, moon, 20.0f, 0.1f); // orbit radius 20 units, orbit speed 0.1f degrees per frame
+// Reduced-resolution atmosphere buffer. Scene depth is blitted down into it so the shells are
+// still hidden behind nearer bodies, then the composite weighs each low-resolution texel by
+// how well its depth matches the full-resolution pixel, which keeps silhouettes sharp.
+struct AtmosphereTarget {
+    GLuint framebuffer = 0;
+    GLuint colorTexture = 0;            // RGBA16F premultiplied radiance and coverage
+    GLuint depthTexture = 0;            // Scene depth at this resolution
+    GLuint compositeFramebuffer = 0;    // HDR color alone, so scene depth can be sampled while compositing
+    GLuint program = 0;
+    int width = 0, height = 0;          // Allocated for half resolution; quarter uses a corner
+    GLuint fragmentQuery = 0;           // GL_SAMPLES_PASSED, for --atmosphere-benchmark only
+    bool countFragments = false;
+    GLuint64 fragments = 0;             // Last frame's, when counting
+};
 
-    // Create sun object
-    Sun sun(10.0f, sunTexture); // Sun radius is 10 units
+struct BloomChain {
+    GLuint framebuffers[BLOOM_MAX_MIPS] = {};
+    GLuint textures[BLOOM_MAX_MIPS] = {};   // R11F_G11F_B10F, each level half the size of the previous
+    int widths[BLOOM_MAX_MIPS] = {};
+    int heights[BLOOM_MAX_MIPS] = {};
+    int levelCount = 0;                     // Levels allocated
+    int activeLevels = 0;                   // Levels used this frame (trimmed by the GPU budget)
+};
 
-    bool running = true;
-    SDL_Event event;
+// Picks the internal render scale from measured GPU frame time. Fill cost scales with pixel
+// count (scale squared), so the scale that would hit the target is scale * sqrt(target / measured).
+// The controller moves part of the way there, rate-limited, and waits out the timer latency
+// after each change so it never reacts to frames rendered before its own last decision.
+class DynamicResolution {
+protected:
+    float scale;
+    float smoothedMs;
+    int framesSinceChange;
 
-    // Main loop
-    while (running) {
-        while (SDL_PollEvent(&event)) {
-            handleInput(event, running, planet);
+public:
+    DynamicResolution() : scale(DRS_MAX_SCALE), smoothedMs(0.0f), framesSinceChange(0) {}
+
+    void update(float gpuMs, bool enabled) {
+        if (!enabled) {
+            scale = DRS_MAX_SCALE;
+            return;
         }
+        if (gpuMs <= 0.0f) return;
 
-        // Update celestial bodies
-        planet.update();
-        sun.update(); // Although sun doesn't need updating, included for consistency
+        smoothedMs = smoothedMs > 0.0f ? smoothedMs * 0.7f + gpuMs * 0.3f : gpuMs;
+        if (++framesSinceChange <= GPU_TIMER_LATENCY) return;
 
-        // Clear the screen and set the background color to black
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glLoadIdentity();
+        float desired = scale * sqrtf(DRS_TARGET_GPU_MS / smoothedMs);
+        float delta = (desired - scale) * 0.5f;
+        if (fabs(delta) < 0.01f) return; // Dead band: don't hunt around the target
 
-        // Set light position at sun's position
-        GLfloat lightPosition[] = { 0.0f, 0.0f, 0.0f, 1.0f };
-        glLightfv(GL_LIGHT0, GL_POSITION, lightPosition);
+        delta = std::max(-DRS_MAX_STEP, std::min(DRS_MAX_STEP, delta));
+        scale = std::max(DRS_MIN_SCALE, std::min(DRS_MAX_SCALE, scale + delta));
+        framesSinceChange = 0;
+    }
 
-        // Set camera to focus on planet
-        gluLookAt(planet.positionX, 0.0f, planet.positionZ + planet.getZoom(),
-            planet.positionX, 0.0f, planet.positionZ,
-            0.0f, 1.0f, 0.0f);
+    float getScale() const { return scale; }
+};
 
-        // Render celestial objects
-        sun.render();
-        planet.render();
+HdrTarget hdrTarget;
+AtmosphereTarget atmosphereTarget;
+BloomChain bloomChain;
+DynamicResolution dynamicResolution;
+int renderWidth = SCREEN_WIDTH, renderHeight = SCREEN_HEIGHT; // Internal resolution this frame
 
-        // Swap buffers (double buffering)
-        SDL_GL_SwapWindow(window);
+// Column-major 4x4 matrix, laid out the way OpenGL expects
+struct Mat4 {
+    float m[16];
+
+    static Mat4 identity() {
+        Mat4 r = {};
+        r.m[0] = r.m[5] = r.m[10] = r.m[15] = 1.0f;
+        return r;
     }
 
-    // Clean up
-    delete moon; // Free the moon object
-    IMG_Quit();
-    cleanup(window, context);
-    return 0;
-}
+    static Mat4 translation(float x, float y, float z) {
+        Mat4 r = identity();
+        r.m[12] = x;
+        r.m[13] = y;
+        r.m[14] = z;
+        return r;
+    }
 
-// SDL Initialization
-void initSDL(SDL_Window*& window, SDL_GLContext& context) {
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
-        std::cerr << "SDL could not initialize! SDL_Error: " << SDL_GetError() << std::endl;
-        exit(1);
+    // Same convention as glRotatef: angle in degrees about an arbitrary axis
+    static Mat4 rotation(float degrees, float x, float y, float z) {
+        float length = sqrtf(x * x + y * y + z * z);
+        x /= length; y /= length; z /= length;
+        float radians = degrees * (float)M_PI / 180.0f;
+        float c = cosf(radians), s = sinf(radians), t = 1.0f - c;
+
+        Mat4 r = identity();
+        r.m[0] = t * x * x + c;     r.m[4] = t * x * y - s * z; r.m[8] = t * x * z + s * y;
+        r.m[1] = t * x * y + s * z; r.m[5] = t * y * y + c;     r.m[9] = t * y * z - s * x;
+        r.m[2] = t * x * z - s * y; r.m[6] = t * y * z + s * x; r.m[10] = t * z * z + c;
+        return r;
     }
 
-    // Set OpenGL version (using 2.1 for compatibility)
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
-    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+    // Same as gluPerspective
+    static Mat4 perspective(float fovyDegrees, float aspect, float zNear, float zFar) {
+        float f = 1.0f / tanf(fovyDegrees * (float)M_PI / 360.0f);
+        Mat4 r = {};
+        r.m[0] = f / aspect;
+        r.m[5] = f;
+        r.m[10] = (zFar + zNear) / (zNear - zFar);
+        r.m[11] = -1.0f;
+        r.m[14] = 2.0f * zFar * zNear / (zNear - zFar);
+        return r;
+    }
 
-    window = SDL_CreateWindow("3D Planet and Moon with Atmospheres",
-        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-        SCREEN_WIDTH, SCREEN_HEIGHT,
-        SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
-    if (!window) {
-        std::cerr << "Window could not be created! SDL_Error: " << SDL_GetError() << std::endl;
-        exit(1);
+    // Reverse-Z with the far plane at infinity, for [0, 1] clip depth (glClipControl). Depth is
+    // zNear / distance: 1 at the near plane, tending to 0 far away.
+    static Mat4 infiniteReversedPerspective(float fovyDegrees, float aspect, float zNear) {
+        float f = 1.0f / tanf(fovyDegrees * (float)M_PI / 360.0f);
+        Mat4 r = {};
+        r.m[0] = f / aspect;
+        r.m[5] = f;
+        r.m[11] = -1.0f;
+        r.m[14] = zNear;
+        return r;
     }
 
-    context = SDL_GL_CreateContext(window);
-    if (!context) {
-        std::cerr << "OpenGL context could not be created! SDL_Error: " << SDL_GetError() << std::endl;
-        exit(1);
+    // Same as gluLookAt
+    static Mat4 lookAt(const float eye[3], const float target[3], const float up[3]) {
+        float f[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+        float fl = sqrtf(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+        f[0] /= fl; f[1] /= fl; f[2] /= fl;
+        float s[3] = { f[1] * up[2] - f[2] * up[1], f[2] * up[0] - f[0] * up[2], f[0] * up[1] - f[1] * up[0] };
+        float sl = sqrtf(s[0] * s[0] + s[1] * s[1] + s[2] * s[2]);
+        s[0] /= sl; s[1] /= sl; s[2] /= sl;
+        float u[3] = { s[1] * f[2] - s[2] * f[1], s[2] * f[0] - s[0] * f[2], s[0] * f[1] - s[1] * f[0] };
+
+        Mat4 r = identity();
+        r.m[0] = s[0]; r.m[4] = s[1]; r.m[8] = s[2];
+        r.m[1] = u[0]; r.m[5] = u[1]; r.m[9] = u[2];
+        r.m[2] = -f[0]; r.m[6] = -f[1]; r.m[10] = -f[2];
+        r.m[12] = -(s[0] * eye[0] + s[1] * eye[1] + s[2] * eye[2]);
+        r.m[13] = -(u[0] * eye[0] + u[1] * eye[1] + u[2] * eye[2]);
+        r.m[14] = f[0] * eye[0] + f[1] * eye[1] + f[2] * eye[2];
+        return r;
     }
 
-    // Enable VSync
-    if (SDL_GL_SetSwapInterval(1) < 0) {
-        std::cerr << "Warning: Unable to set VSync! SDL_Error: " << SDL_GetError() << std::endl;
+    // Shift a perspective projection by an offset in NDC, for sub-pixel jitter
+    Mat4 jittered(float x, float y) const {
+        Mat4 r = *this;
+        r.m[8] -= x; // Multiplied by view z, which the divide by w = -z turns into a constant offset
+        r.m[9] -= y;
+        return r;
     }
-}
 
-// OpenGL Initialization
-void initOpenGL() {
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(45.0, (double)SCREEN_WIDTH / (double)SCREEN_HEIGHT, 1.0, 1000.0); // Increased far clipping plane
+    Mat4 operator*(const Mat4& other) const {
+        Mat4 r;
+        for (int column = 0; column < 4; ++column) {
+            for (int row = 0; row < 4; ++row) {
+                float sum = 0.0f;
+                for (int k = 0; k < 4; ++k) sum += m[k * 4 + row] * other.m[column * 4 + k];
+                r.m[column * 4 + row] = sum;
+            }
+        }
+        return r;
+    }
+};
 
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
+// Body draws whose transforms feed motion vectors, one key per body and layer
+enum MotionKey {
+    MOTION_UNTRACKED = -1,
+    MOTION_SUN,
+    MOTION_PLANET,
+    MOTION_PLANET_ATMOSPHERE,
+    MOTION_MOON,
+    MOTION_MOON_ATMOSPHERE,
+    MOTION_RINGS,
+    MOTION_KEY_COUNT
+};
 
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_LIGHTING);
-    glEnable(GL_LIGHT0);
+// Temporal anti-aliasing. Each frame is rendered with a sub-pixel jitter and resolved into a
+// history at output resolution, so the internal resolution can drop below it (temporal
+// upsampling). The body shader writes screen-space motion to a second HDR attachment; the
+// camera only translates, so the cleared background and the stars at infinity have none.
+struct TemporalAA {
+    GLuint program = 0;
+    GLuint velocityTexture = 0;            // RG16F, attachment 1 of the HDR target
+    GLuint historyFramebuffers[2] = {};
+    GLuint historyTextures[2] = {};        // RGBA16F at output resolution, written alternately
+    int current = 0;                       // History written this frame
+    bool active = false;                   // Jittering and resolving this frame
+    bool historyValid = false;
+    Uint32 frameIndex = 0;
+    float jitter[2] = {};                  // This frame's offset in render texels
+    Mat4 previousProjection = Mat4::identity(); // Unjittered
+    GLint renderSizeLocation = -1, jitterLocation = -1, currentWeightLocation = -1;
 
-    GLfloat lightPosition[] = { 0.0f, 0.0f, 0.0f, 1.0f }; // Light at sun's position
-    glLightfv(GL_LIGHT0, GL_POSITION, lightPosition);
+    // Each body draw finds its own transform from the previous frame by its MotionKey, so
+    // toggling the moon or the rings leaves the others' motion intact. Draws that were not
+    // made last frame get no motion.
+    Mat4 modelViews[MOTION_KEY_COUNT];
+    Mat4 previousModelViews[MOTION_KEY_COUNT];
+    bool drawn[MOTION_KEY_COUNT] = {}, previouslyDrawn[MOTION_KEY_COUNT] = {};
 
-    glShadeModel(GL_SMOOTH);
-    glEnable(GL_TEXTURE_2D);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-}
+    void beginFrame() {
+        memcpy(previousModelViews, modelViews, sizeof(modelViews));
+        memcpy(previouslyDrawn, drawn, sizeof(drawn));
+        memset(drawn, 0, sizeof(drawn));
+    }
 
-// Handle input
-void handleInput(SDL_Event& event, bool& running, Planet& planet) {
-    switch (event.type) {
-    case SDL_QUIT:
-        running = false;
-        break;
-    case SDL_MOUSEMOTION:
-        if (dragging) {
-            int dx = event.motion.x - lastMouseX;
-            int dy = event.motion.y - lastMouseY;
+    Mat4 previousModelView(MotionKey key, const Mat4& modelView) {
+        if (key == MOTION_UNTRACKED) return modelView;
+        modelViews[key] = modelView;
+        drawn[key] = true;
+        return previouslyDrawn[key] ? previousModelViews[key] : modelView;
+    }
+};
 
-            sphereRotationY += dx * 0.5f;
-            sphereRotationX -= dy * 0.5f;
+TemporalAA temporalAA; // Render thread only
 
-            // Clamp the X-axis rotation to prevent flipping
-            if (sphereRotationX > 40.0f) sphereRotationX = 40.0f;
-            if (sphereRotationX < -40.0f) sphereRotationX = -40.0f;
+// Per-frame dynamic data (uniform blocks, instance attributes) is written straight into a
+// persistently mapped buffer split into FRAMES_IN_FLIGHT regions. Each frame bump-allocates
+// from its own region; a fence placed at the end of the frame guards the region until the GPU
+// has consumed it, by which time the CPU is two frames ahead and the wait is normally free.
+// Without ARB_buffer_storage the same interface stages into CPU memory and commit() uploads.
+const int FRAMES_IN_FLIGHT = 3;
+const GLsizeiptr FRAME_RING_BYTES = 256 * 1024; // Per frame region
 
-            lastMouseX = event.motion.x;
-            lastMouseY = event.motion.y;
+class FrameRingBuffer {
+protected:
+    GLuint buffer;
+    unsigned char* mapped;              // Persistent mapping, or CPU staging for the fallback
+    GLsync fences[FRAMES_IN_FLIGHT];
+    GLsizeiptr regionSize;
+    GLint alignment;
+    int region;
+    GLsizeiptr offset;
+    bool persistent;
+    bool overflowReported;
+
+public:
+    FrameRingBuffer() : buffer(0), mapped(nullptr), regionSize(0), alignment(256), region(0), offset(0),
+        persistent(false), overflowReported(false) {
+        for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) fences[i] = nullptr;
+    }
+
+    bool init(GLsizeiptr bytesPerFrame) {
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        regionSize = (bytesPerFrame + alignment - 1) / alignment * alignment;
+        GLsizeiptr totalSize = regionSize * FRAMES_IN_FLIGHT;
 
-            planet.setRotation(sphereRotationX, sphereRotationY);
-            lastInteractionTime = SDL_GetTicks();  // Update the last interaction time
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        persistent = glCaps.bufferStorage;
+        if (persistent) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_UNIFORM_BUFFER, totalSize, nullptr, flags);
+            mapped = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, totalSize, flags);
+            persistent = mapped != nullptr;
         }
-        break;
-    case SDL_MOUSEBUTTONDOWN:
-        if (event.button.button == SDL_BUTTON_LEFT) {
-            dragging = true;
-            lastMouseX = event.button.x;
-            lastMouseY = event.button.y;
+        if (!persistent) {
+            glBufferData(GL_UNIFORM_BUFFER, totalSize, nullptr, GL_STREAM_DRAW);
+            mapped = new unsigned char[totalSize];
         }
-        break;
-    case SDL_MOUSEBUTTONUP:
-        if (event.button.button == SDL_BUTTON_LEFT) {
-            dragging = false;
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        return buffer != 0;
+    }
+
+    void release() {
+        for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+            if (fences[i]) glDeleteSync(fences[i]);
+            fences[i] = nullptr;
         }
-        break;
-    case SDL_MOUSEWHEEL:
-        if (event.wheel.y > 0) {
-            planet.setZoom(planet.getZoom() - 0.5f); // Zoom in
+        if (buffer && persistent) {
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
         }
-        else if (event.wheel.y < 0) {
-            planet.setZoom(planet.getZoom() + 0.5f); // Zoom out
+        else {
+            delete[] mapped;
         }
-        if (planet.getZoom() < MIN_ZOOM) planet.setZoom(MIN_ZOOM);
-        if (planet.getZoom() > MAX_ZOOM) planet.setZoom(MAX_ZOOM);
-        break;
+        if (buffer) glDeleteBuffers(1, &buffer);
+        buffer = 0;
+        mapped = nullptr;
     }
-}
 
-// Load texture function
-GLuint loadTexture(const char* filename) {
-    SDL_Surface* surface = IMG_Load(filename);
-    if (!surface) {
-        std::cerr << "Failed to load texture (" << filename << "): " << IMG_GetError() << std::endl;
-        exit(1);
+    // Move to the next region, waiting for the GPU to finish with it if it hasn't yet
+    void beginFrame() {
+        region = (region + 1) % FRAMES_IN_FLIGHT;
+        offset = 0;
+        if (fences[region]) {
+            glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+            glDeleteSync(fences[region]);
+            fences[region] = nullptr;
+        }
     }
 
-    GLuint textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_2D, textureID);
+    // Returns write-only memory for this frame, or nullptr when the region is exhausted.
+    // bufferOffset receives the position to pass to glBindBufferRange.
+    void* allocate(GLsizeiptr size, GLintptr& bufferOffset) {
+        GLsizeiptr alignedSize = (size + alignment - 1) / alignment * alignment;
+        if (!buffer || offset + alignedSize > regionSize) {
+            if (buffer && !overflowReported) {
+                std::cerr << "Warning: frame ring buffer region exhausted, dropping draws" << std::endl;
+                overflowReported = true;
+            }
+            return nullptr;
+        }
+        bufferOffset = region * regionSize + offset;
+        offset += alignedSize;
+        return mapped + bufferOffset;
+    }
 
-    // Set texture parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);    // Horizontal wrapping
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);    // Vertical wrapping
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); // Minification filter
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); // Magnification filter
+    // Make written data visible to the GPU. Free with a coherent persistent mapping.
+    void commit(GLintptr bufferOffset, GLsizeiptr size) {
+        if (persistent) return;
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, bufferOffset, size, mapped + bufferOffset);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
 
-    // Determine the format
-    GLenum format;
-    if (surface->format->BytesPerPixel == 3) {
-        format = GL_RGB;
+    // Fence the region once every draw reading it has been submitted
+    void endFrame() {
+        if (buffer) fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
     }
-    else if (surface->format->BytesPerPixel == 4) {
-        format = GL_RGBA;
+
+    GLuint getBuffer() const { return buffer; }
+};
+
+FrameRingBuffer frameRing; // Render thread only
+
+// Uniform block layouts shared with BODY_VERTEX_SHADER (std140)
+const GLuint FRAME_UNIFORM_BINDING = 0;
+const GLuint BODY_UNIFORM_BINDING = 1;
+
+const int MAX_SHADOW_OCCLUDERS = 4;
+
+struct FrameUniforms {
+    float projection[16];
+    float view[16];
+    float sunPosition[4];   // View space centre, w: radius
+    float previousProjection[16]; // Last frame's, unjittered
+    float jitter[4];        // xy: this frame's projection offset in NDC
+};
+
+struct BodyUniforms {
+    float modelView[16];
+    float tint[4];
+    float material[4];      // x: emissive intensity (0 = lit by the sun), y: occluder count, z: 1 for ring shading,
+                            // w: 1 when a packed surface material is bound to unit 1
+    float occluders[MAX_SHADOW_OCCLUDERS][4]; // View space centre and radius of spheres that can shadow this body
+    float previousModelView[16];    // Same draw last frame, for motion vectors
+};
+
+// Occluders the broad phase picked for one receiver
+struct ShadowSet {
+    float spheres[MAX_SHADOW_OCCLUDERS][4];
+    int count = 0;
+};
+
+// GPU-driven small body field. Orbits and bounds live in storage buffers; each frame a compute
+// pass solves every body's Kepler equation, culls against the frustum and a minimum projected
+// size, picks a LOD and appends survivors to that LOD's instance range while bumping its
+// indirect draw command. One glMultiDrawElementsIndirect then draws every mesh LOD and one
+// glDrawArraysIndirect the bodies too small for a mesh as point sprites, so CPU cost doesn't
+// grow with body count. A million bodies take about 48 MB of orbits and 80 MB of bounds and
+// instance ranges.
+const int BODY_FIELD_LOD_COUNT = 3;     // Mesh LODs; point sprites come after the last
+const int BODY_FIELD_LOD_SLICES[BODY_FIELD_LOD_COUNT] = { 24, 12, 6 };
+const int BODY_FIELD_LOD_STACKS[BODY_FIELD_LOD_COUNT] = { 16, 8, 4 };
+const float BODY_FIELD_LOD_PIXEL_RADIUS[BODY_FIELD_LOD_COUNT - 1] = { 24.0f, 6.0f }; // Switch to the next LOD below these
+const float BODY_FIELD_POINT_PIXEL_RADIUS = 1.5f; // Below this a body is a lit point sprite instead of a mesh
+const float BODY_FIELD_MIN_PIXEL_RADIUS = 0.05f;  // Smaller than this on screen is culled; points fade by covered area above it
+const float BODY_FIELD_POINT_ALBEDO[3] = { 0.45f, 0.42f, 0.40f }; // Grey rock, roughly the moon texture's average
+const int BODY_FIELD_WORKGROUP_SIZE = 64;
+const int BODY_FIELD_GENERATE_GRAIN = 16384; // Orbits per generation job; each chunk seeds its own generator
+
+// Keplerian orbit around the sun, folded like OrbitBatch's. std430 layout shared with
+// BODY_FIELD_CULL_SHADER.
+struct SmallBodyOrbit {
+    float periapsisAxis[3], eccentricity;       // Towards periapsis, times the semi-major axis
+    float normalAxis[3], meanAnomalyAtZero;     // 90 degrees on in the plane, times the semi-minor axis
+    float meanMotion, bodyRadius, pad0, pad1;   // Radians per second, body size
+};
+
+// Matches the DrawArraysIndirectCommand layout glDrawArraysIndirect reads
+struct DrawArraysIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint first;
+    GLuint baseInstance;
+};
+
+// Matches the DrawElementsIndirectCommand layout glMultiDrawElementsIndirect reads
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+struct BodyField {
+    GLuint cullProgram = 0;
+    GLuint drawProgram = 0;
+    GLuint pointProgram = 0;
+    GLuint vertexArray = 0;
+    GLuint pointVertexArray = 0;  // Reads the point range of the instance buffer as vertices
+    GLuint meshVertices = 0, meshIndices = 0;
+    GLuint orbitBuffer = 0;       // SmallBodyOrbit per body, static
+    GLuint boundsBuffer = 0;      // vec4 centre + radius per body, rewritten by the cull pass
+    GLuint instanceBuffer = 0;    // Visible bodies, BODY_FIELD_LOD_COUNT mesh ranges and a point range of bodyCount each
+    GLuint commandBuffer = 0;     // One DrawElementsIndirectCommand per LOD
+    GLuint pointCommandBuffer = 0; // DrawArraysIndirectCommand for the point sprites
+    GLuint texture = 0;
+    DrawElementsIndirectCommand commandTemplate[BODY_FIELD_LOD_COUNT] = {};
+    int bodyCount = 0;
+    bool cpuPositions = false;    // Bounds come from the N-body mode instead of the orbit evaluation
+};
+
+BodyField bodyField;
+
+// Read-only memory-mapped file. The OS pages the contents in on demand, so binary data files
+// are used in place with no read or parse step.
+class MappedFile {
+protected:
+    HANDLE file, mapping;
+    const void* data;
+    size_t size;
+
+public:
+    MappedFile() : file(INVALID_HANDLE_VALUE), mapping(nullptr), data(nullptr), size(0) {}
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const char* path) {
+        close();
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER fileSize;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping) data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+        if (!data) {
+            close();
+            return false;
+        }
+        size = (size_t)fileSize.QuadPart;
+        return true;
     }
-    else {
-        std::cerr << "Unsupported image format for texture: " << filename << std::endl;
-        SDL_FreeSurface(surface);
-        exit(1);
+
+    void close() {
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+        mapping = nullptr;
+        data = nullptr;
+        size = 0;
     }
 
-    // Upload the texture to OpenGL
-    glTexImage2D(GL_TEXTURE_2D, 0, format, surface->w, surface->h, 0, format, GL_UNSIGNED_BYTE, surface->pixels);
-    SDL_FreeSurface(surface);
-    return textureID;
+    const void* getData() const { return data; }
+    size_t getSize() const { return size; }
+};
+
+// Cached program binary: this header, then the driver's blob. The format enum and the blob
+// are only meaningful to the driver that produced them, which the file name accounts for.
+const char PROGRAM_BINARY_MAGIC[4] = { 'P', 'R', 'O', 'G' };
+
+struct ProgramBinaryHeader {
+    char magic[4];
+    GLenum format;
+    Uint32 length;
+};
+
+// Binary star catalog, written by --convert-stars. A header followed by fixed-size records
+// sorted brightest first, so the records up to any magnitude limit form a prefix and the file
+// can go straight into a vertex buffer. Little-endian.
+const char STAR_CATALOG_MAGIC[4] = { 'S', 'T', 'A', 'R' };
+const Uint32 STAR_CATALOG_VERSION = 1;
+
+struct StarCatalogHeader {
+    char magic[4];
+    Uint32 version;
+    Uint32 count;
+    Uint32 recordSize;
+};
+
+struct StarRecord {
+    float direction[3];     // Unit vector in scene axes (see convertStarCatalog)
+    float magnitude;        // Apparent visual magnitude
+    Uint32 color;           // RGBA8 from the B-V color index
+};
+
+// One vertex buffer holding the catalog, drawn as point sprites in a single call
+struct StarField {
+    GLuint program = 0;
+    GLuint vertexArray = 0;
+    GLuint vertices = 0;
+    int drawCount = 0;      // Stars at or above STAR_MAGNITUDE_LIMIT
+};
+
+StarField starField;
+
+// Ring geometry for the ringed planet: one indexed annulus drawn with the body shader, plus
+// debris particles stored sector by sector so culling just picks a count per sector
+struct RingSystem {
+    GLuint annulusVertices = 0;
+    GLuint annulusIndices = 0;
+    int annulusIndexCount = 0;
+    GLuint debrisProgram = 0;
+    GLuint debrisVertexArray = 0;
+    GLuint debrisMesh = 0;        // One rock, drawn instanced
+    GLuint debrisInstances = 0;   // vec4 ring-space centre + size, RING_DEBRIS_PER_SECTOR per sector
+    int debrisMeshVertexCount = 0;
+    float innerRadius = 0.0f, outerRadius = 0.0f;
+};
+
+RingSystem ringSystem;
+
+// Shader programs (0 when unavailable; callers fall back to fixed function)
+GLuint bodyProgram = 0;
+GLuint bloomDownsampleProgram = 0;
+GLuint bloomUpsampleProgram = 0;
+GLuint tonemapProgram = 0;
+
+// Write one draw's BodyUniforms into this frame's ring region and bind them. False if the
+// ring is full this frame.
+bool bindBodyUniforms(const Mat4& modelView, MotionKey motion, float emissive, const ShadowSet* shadows, float ringShading = 0.0f,
+    bool surfaceMaterial = false, float alpha = 1.0f) {
+    GLintptr offset = 0;
+    BodyUniforms* uniforms = (BodyUniforms*)frameRing.allocate(sizeof(BodyUniforms), offset);
+    if (!uniforms) return false;
+    memcpy(uniforms->modelView, modelView.m, sizeof(uniforms->modelView));
+    uniforms->tint[0] = uniforms->tint[1] = uniforms->tint[2] = 1.0f;
+    uniforms->tint[3] = alpha;
+    uniforms->material[0] = emissive;
+    uniforms->material[1] = shadows ? (float)shadows->count : 0.0f;
+    uniforms->material[2] = ringShading;
+    uniforms->material[3] = surfaceMaterial ? 1.0f : 0.0f;
+    if (shadows) memcpy(uniforms->occluders, shadows->spheres, shadows->count * sizeof(shadows->spheres[0]));
+    memcpy(uniforms->previousModelView, temporalAA.previousModelView(motion, modelView).m, sizeof(uniforms->previousModelView));
+    frameRing.commit(offset, sizeof(BodyUniforms));
+    glBindBufferRange(GL_UNIFORM_BUFFER, BODY_UNIFORM_BINDING, frameRing.getBuffer(), offset, sizeof(BodyUniforms));
+    return true;
 }
 
-// Cleanup resources
-void cleanup(SDL_Window* window, SDL_GLContext context) {
-    SDL_GL_DeleteContext(context);
+// Draw a textured sphere. With the body shader the per-draw uniforms are written straight
+// into this frame's ring buffer region; otherwise the matrix goes to the fixed-function stack.
+// Alpha below 1 makes the sphere translucent, for atmosphere shells.
+void drawBodySphere(const Mat4& modelView, MotionKey motion, float radius, int slices, int stacks, GLuint texture, float emissive,
+    const ShadowSet* shadows = nullptr, GLuint materialTexture = 0, float alpha = 1.0f) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    if (bodyProgram) {
+        if (!bindBodyUniforms(modelView, motion, emissive, shadows, 0.0f, materialTexture != 0, alpha)) return;
+        if (materialTexture) {
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, materialTexture);
+            glActiveTexture(GL_TEXTURE0);
+        }
+    }
+    else {
+        glLoadMatrixf(modelView.m);
+        glColor4f(1.0f, 1.0f, 1.0f, alpha);
+    }
+
+    GLUquadric* quadric = gluNewQuadric();
+    gluQuadricTexture(quadric, GL_TRUE);
+    gluSphere(quadric, radius, slices, stacks);
+    gluDeleteQuadric(quadric);
+    if (!bodyProgram) glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+}
+
+// The ring annulus in one draw, through the body shader's ring branch. Translucent, so it
+// tests against depth without writing it.
+void drawRingAnnulus(const Mat4& ringModelView, GLuint texture, const ShadowSet& shadows) {
+    if (!bindBodyUniforms(ringModelView, MOTION_RINGS, 0.0f, &shadows, 1.0f)) return;
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glDepthMask(GL_FALSE);
+
+    glBindBuffer(GL_ARRAY_BUFFER, ringSystem.annulusVertices);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 8 * sizeof(float), (void*)0);
+    glNormalPointer(GL_FLOAT, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+    glTexCoordPointer(2, GL_FLOAT, 8 * sizeof(float), (void*)(6 * sizeof(float)));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ringSystem.annulusIndices);
+    glDrawElements(GL_TRIANGLES, ringSystem.annulusIndexCount, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glDepthMask(GL_TRUE);
+}
+
+// Keplerian orbits. Elements are relative to the parent body, in a frame whose reference plane
+// is the scene's XZ plane with +Y as north. Angles in radians, times in seconds of simulated
+// time. Positions are a function of absolute time alone, so nothing drifts however the
+// simulation is stepped.
+struct OrbitalElements {
+    double semiMajorAxis;
+    double eccentricity;        // Elliptic orbits only: 0 <= e < 1
+    double inclination;
+    double ascendingNode;       // Longitude of the ascending node, from +X towards +Z
+    double argumentOfPeriapsis; // From the ascending node, in the orbital plane
+    double meanAnomalyAtEpoch;
+    double epoch;
+    double meanMotion;          // Radians per second, 2 pi / period
+};
+
+// An orbit's in-plane axes in scene space: towards periapsis and 90 degrees on in the
+// direction of motion, scaled by the semi-major and semi-minor axes. Perifocal (x, y, north)
+// maps onto the scene's (X, Z, Y), so north is +Y.
+void orbitAxes(const OrbitalElements& orbit, double periapsisAxis[3], double normalAxis[3]) {
+    double cosNode = cos(orbit.ascendingNode), sinNode = sin(orbit.ascendingNode);
+    double cosPeriapsis = cos(orbit.argumentOfPeriapsis), sinPeriapsis = sin(orbit.argumentOfPeriapsis);
+    double cosInclination = cos(orbit.inclination), sinInclination = sin(orbit.inclination);
+    double semiMinorAxis = orbit.semiMajorAxis * sqrt(1.0 - orbit.eccentricity * orbit.eccentricity);
+
+    double p[3] = { cosNode * cosPeriapsis - sinNode * sinPeriapsis * cosInclination,
+        sinNode * cosPeriapsis + cosNode * sinPeriapsis * cosInclination, sinPeriapsis * sinInclination };
+    double q[3] = { -cosNode * sinPeriapsis - sinNode * cosPeriapsis * cosInclination,
+        -sinNode * sinPeriapsis + cosNode * cosPeriapsis * cosInclination, cosPeriapsis * sinInclination };
+    const int sceneAxis[3] = { 0, 2, 1 };
+    for (int axis = 0; axis < 3; ++axis) {
+        periapsisAxis[sceneAxis[axis]] = p[axis] * orbit.semiMajorAxis;
+        normalAxis[sceneAxis[axis]] = q[axis] * semiMinorAxis;
+    }
+}
+
+// Two-lane double precision sine and cosine for the Kepler solver. Cody-Waite reduction by
+// pi / 2, then the fdlibm kernel polynomials on [-pi / 4, pi / 4]; accurate to a couple of ulp
+// for the small arguments the solver produces.
+inline void sinCos2(__m128d x, __m128d& sine, __m128d& cosine) {
+    const __m128d roundMagic = _mm_set1_pd(6755399441055744.0); // 1.5 * 2^52: adding it rounds to an integer
+    __m128d quadrantBits = _mm_add_pd(_mm_mul_pd(x, _mm_set1_pd(0.63661977236758134308)), roundMagic);
+    __m128d quadrant = _mm_sub_pd(quadrantBits, roundMagic);
+    __m128d r = _mm_sub_pd(x, _mm_mul_pd(quadrant, _mm_set1_pd(1.57079632673412561417)));
+    r = _mm_sub_pd(r, _mm_mul_pd(quadrant, _mm_set1_pd(6.07710050650619224932e-11)));
+
+    __m128d r2 = _mm_mul_pd(r, r);
+    __m128d s = _mm_add_pd(_mm_set1_pd(-2.50507602534068634195e-08), _mm_mul_pd(r2, _mm_set1_pd(1.58969099521155010221e-10)));
+    s = _mm_add_pd(_mm_set1_pd(2.75573137070700676789e-06), _mm_mul_pd(r2, s));
+    s = _mm_add_pd(_mm_set1_pd(-1.98412698298579493134e-04), _mm_mul_pd(r2, s));
+    s = _mm_add_pd(_mm_set1_pd(8.33333333332248946124e-03), _mm_mul_pd(r2, s));
+    s = _mm_add_pd(_mm_set1_pd(-1.66666666666666324348e-01), _mm_mul_pd(r2, s));
+    s = _mm_add_pd(r, _mm_mul_pd(_mm_mul_pd(r2, r), s));
+    __m128d c = _mm_add_pd(_mm_set1_pd(2.08757232129817482790e-09), _mm_mul_pd(r2, _mm_set1_pd(-1.13596475577881948265e-11)));
+    c = _mm_add_pd(_mm_set1_pd(-2.75573143513906633035e-07), _mm_mul_pd(r2, c));
+    c = _mm_add_pd(_mm_set1_pd(2.48015872894767294178e-05), _mm_mul_pd(r2, c));
+    c = _mm_add_pd(_mm_set1_pd(-1.38888888888741095749e-03), _mm_mul_pd(r2, c));
+    c = _mm_add_pd(_mm_set1_pd(4.16666666666666019037e-02), _mm_mul_pd(r2, c));
+    c = _mm_add_pd(_mm_sub_pd(_mm_set1_pd(1.0), _mm_mul_pd(r2, _mm_set1_pd(0.5))), _mm_mul_pd(_mm_mul_pd(r2, r2), c));
+
+    // The low bits of quadrantBits hold the quadrant: bit 0 swaps sine and cosine, bit 1 (of
+    // q for sine, q + 1 for cosine) flips the sign
+    __m128i q = _mm_castpd_si128(quadrantBits);
+    __m128i odd = _mm_shuffle_epi32(_mm_and_si128(q, _mm_set1_epi32(1)), _MM_SHUFFLE(2, 2, 0, 0));
+    __m128d swap = _mm_castsi128_pd(_mm_cmpeq_epi32(odd, _mm_set1_epi32(1)));
+    __m128d signBit = _mm_set1_pd(-0.0);
+    __m128d sineSign = _mm_and_pd(_mm_castsi128_pd(_mm_slli_epi64(q, 62)), signBit);
+    __m128d cosineSign = _mm_and_pd(_mm_castsi128_pd(_mm_slli_epi64(_mm_add_epi64(q, _mm_set_epi32(0, 1, 0, 1)), 62)), signBit);
+    sine = _mm_xor_pd(_mm_or_pd(_mm_and_pd(swap, c), _mm_andnot_pd(swap, s)), sineSign);
+    cosine = _mm_xor_pd(_mm_or_pd(_mm_and_pd(swap, s), _mm_andnot_pd(swap, c)), cosineSign);
+}
+
+// Orbits in structure-of-arrays form, propagated two at a time with SSE2. Each orbit's
+// elements are folded into a mean anomaly at time zero and the two in-plane axes scaled by
+// the ellipse's semi-axes, so propagation is just the Kepler solve plus two multiply-adds.
+class OrbitBatch {
+protected:
+    std::vector<double> meanAnomalyAtZero, meanMotion, eccentricity;
+    std::vector<double> periapsisAxis[3];   // Towards periapsis, times the semi-major axis
+    std::vector<double> normalAxis[3];      // 90 degrees on in the orbital plane, times the semi-minor axis
+    size_t count;
+
+public:
+    OrbitBatch() : count(0) {}
+
+    void add(const OrbitalElements& orbit) {
+        double p[3], q[3];
+        orbitAxes(orbit, p, q);
+
+        // Keep every array padded to whole SIMD pairs with a harmless circular orbit
+        if (count % 2 == 0) {
+            meanAnomalyAtZero.resize(count + 2, 0.0);
+            meanMotion.resize(count + 2, 0.0);
+            eccentricity.resize(count + 2, 0.0);
+            for (int axis = 0; axis < 3; ++axis) {
+                periapsisAxis[axis].resize(count + 2, 0.0);
+                normalAxis[axis].resize(count + 2, 0.0);
+            }
+        }
+        meanAnomalyAtZero[count] = orbit.meanAnomalyAtEpoch - orbit.meanMotion * orbit.epoch;
+        meanMotion[count] = orbit.meanMotion;
+        eccentricity[count] = orbit.eccentricity;
+        for (int axis = 0; axis < 3; ++axis) {
+            periapsisAxis[axis][count] = p[axis];
+            normalAxis[axis][count] = q[axis];
+        }
+        ++count;
+    }
+
+    size_t size() const { return count; }
+
+    // Whether an orbit goes anywhere; fixed roots have zero mean motion
+    bool moves(size_t index) const { return meanMotion[index] != 0.0; }
+
+    // Mean anomaly of one orbit at a time, wrapped to [0, 2 pi)
+    double meanAnomaly(size_t index, double time) const {
+        double anomaly = fmod(meanAnomalyAtZero[index] + meanMotion[index] * time, 2.0 * M_PI);
+        return anomaly < 0.0 ? anomaly + 2.0 * M_PI : anomaly;
+    }
+
+    // Positions of every orbit at an absolute time. Kepler's equation E - e sin E = M is solved
+    // with Halley's method from Danby's starting guess, a fixed number of iterations so both
+    // lanes stay in step; that converges to full double precision for e up to about 0.95.
+    // The outputs need room for size() rounded up to even.
+    void propagate(double time, double* x, double* y, double* z) const {
+        propagate(time, x, y, z, 0, count);
+    }
+
+    // Same for orbits [first, last) only, so ranges can be spread over threads. first must be even.
+    void propagate(double time, double* x, double* y, double* z, size_t first, size_t last) const {
+        const __m128d twoPi = _mm_set1_pd(2.0 * M_PI), inverseTwoPi = _mm_set1_pd(0.5 / M_PI);
+        const __m128d roundMagic = _mm_set1_pd(6755399441055744.0);
+        const __m128d signBit = _mm_set1_pd(-0.0), half = _mm_set1_pd(0.5), one = _mm_set1_pd(1.0);
+        __m128d t = _mm_set1_pd(time);
+        for (size_t i = first; i < last; i += 2) {
+            __m128d e = _mm_loadu_pd(&eccentricity[i]);
+            __m128d mean = _mm_add_pd(_mm_loadu_pd(&meanAnomalyAtZero[i]), _mm_mul_pd(_mm_loadu_pd(&meanMotion[i]), t));
+            __m128d turns = _mm_sub_pd(_mm_add_pd(_mm_mul_pd(mean, inverseTwoPi), roundMagic), roundMagic);
+            mean = _mm_sub_pd(mean, _mm_mul_pd(turns, twoPi)); // Now in [-pi, pi]
+
+            // Danby: E0 = M + 0.85 e sign(M)
+            __m128d anomaly = _mm_add_pd(mean, _mm_or_pd(_mm_mul_pd(e, _mm_set1_pd(0.85)), _mm_and_pd(mean, signBit)));
+            __m128d sine, cosine;
+            for (int iteration = 0; iteration < KEPLER_ITERATIONS; ++iteration) {
+                sinCos2(anomaly, sine, cosine);
+                __m128d eSine = _mm_mul_pd(e, sine);
+                __m128d f = _mm_sub_pd(_mm_sub_pd(anomaly, eSine), mean);
+                __m128d slope = _mm_sub_pd(one, _mm_mul_pd(e, cosine));
+                __m128d denominator = _mm_sub_pd(slope, _mm_div_pd(_mm_mul_pd(_mm_mul_pd(half, f), eSine), slope));
+                anomaly = _mm_sub_pd(anomaly, _mm_div_pd(f, denominator));
+            }
+            sinCos2(anomaly, sine, cosine);
+
+            __m128d alongPeriapsis = _mm_sub_pd(cosine, e);
+            double* outputs[3] = { x, y, z };
+            for (int axis = 0; axis < 3; ++axis) {
+                __m128d position = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(&periapsisAxis[axis][i]), alongPeriapsis),
+                    _mm_mul_pd(_mm_loadu_pd(&normalAxis[axis][i]), sine));
+                _mm_storeu_pd(outputs[axis] + i, position);
+            }
+        }
+    }
+};
+
+// The scene's two Keplerian orbits, shared by the scene setup and --build-ephemeris
+OrbitalElements planetOrbitElements(double semiMajorAxis) {
+    return { semiMajorAxis, PLANET_ECCENTRICITY, 0.0, 0.0, 0.0, 0.0, 0.0, PLANET_ORBIT_SPEED * M_PI / 180.0 };
+}
+
+// Realistic distance and size, on a slightly inclined orbit
+OrbitalElements moonOrbitElements() {
+    return { 5.0, MOON_ECCENTRICITY, MOON_INCLINATION, 0.0, 0.0, 0.0, 0.0, MOON_ORBIT_SPEED };
+}
+
+// Binary ephemeris, read by --ephemeris and written by --build-ephemeris. A header, then one
+// EphemerisBody record per body, then each body's segments: consecutive equal spans of
+// simulated time, each holding the Chebyshev coefficients of x, then y, then z (degree + 1
+// each, lowest order first). Positions are in scene units from the body's parent.
+// Little-endian.
+const char EPHEMERIS_MAGIC[4] = { 'E', 'P', 'H', 'M' };
+const Uint32 EPHEMERIS_VERSION = 1;
+const Uint32 EPHEMERIS_MAX_DEGREE = 31;
+const Uint32 EPHEMERIS_UNCOVERED = 0xffffffffu; // Segment index for a body the file doesn't cover at the time
+
+struct EphemerisHeader {
+    char magic[4];
+    Uint32 version;
+    Uint32 bodyCount;
+    Uint32 bodyRecordSize;
+};
+
+struct EphemerisBody {
+    char name[16];          // Matched against the scene's bodies: "planet" or "moon"
+    double startTime;       // Simulated seconds at the start of the first segment
+    double segmentLength;   // Seconds per segment
+    Uint32 segmentCount;
+    Uint32 degree;          // Highest Chebyshev order
+    Uint64 offset;          // First segment's coefficients, in bytes from the start of the file
+};
+
+// Positions from a mapped ephemeris file. Coefficients are read in place from the mapping;
+// when time leaves a body's cached segment, that segment is copied out once into padded
+// structure-of-arrays form, so every later lookup in it is a Clenshaw recurrence per axis with
+// two bodies per SSE2 step. Bodies of lower degree are padded with zero coefficients.
+class Ephemeris {
+protected:
+    MappedFile file;
+    const EphemerisBody* records;
+    size_t count, padded;                   // padded: count rounded up to whole SIMD pairs
+    Uint32 degree;                          // Highest over all bodies
+    std::vector<int> target;                // Store body each entry drives, -1 for none
+    std::vector<Uint32> segment;            // Cached segment per body, or EPHEMERIS_UNCOVERED
+    std::vector<double> segmentStart, inverseHalfLength;
+    std::vector<double> coefficients[3];    // [order * padded + body] per axis
+    std::vector<double> positions[3];       // Last evaluate(time) result per axis
+
+    // Make the segment covering time current for one body; false outside the file's span
+    bool select(size_t body, double time) {
+        const EphemerisBody& record = records[body];
+        double position = (time - record.startTime) / record.segmentLength;
+        if (!(position >= 0.0 && position <= (double)record.segmentCount)) {
+            segment[body] = EPHEMERIS_UNCOVERED;
+            return false;
+        }
+        Uint32 index = std::min((Uint32)position, record.segmentCount - 1); // The very end belongs to the last segment
+        if (index == segment[body]) return true;
+
+        segment[body] = index;
+        segmentStart[body] = record.startTime + index * record.segmentLength;
+        const double* source = (const double*)((const char*)file.getData() + record.offset) + (size_t)index * 3 * (record.degree + 1);
+        for (int axis = 0; axis < 3; ++axis) {
+            for (Uint32 order = 0; order <= degree; ++order) {
+                coefficients[axis][order * padded + body] = order <= record.degree ? source[axis * (record.degree + 1) + order] : 0.0;
+            }
+        }
+        return true;
+    }
+
+public:
+    Ephemeris() : records(nullptr), count(0), padded(0), degree(0) {}
+
+    // Map and validate a file. On failure the ephemeris stays empty and the reason is printed.
+    bool open(const char* path) {
+        count = 0;
+        if (!file.open(path)) {
+            std::cerr << "Ephemeris " << path << " not found" << std::endl;
+            return false;
+        }
+        const EphemerisHeader* header = (const EphemerisHeader*)file.getData();
+        if (file.getSize() < sizeof(EphemerisHeader) || memcmp(header->magic, EPHEMERIS_MAGIC, sizeof(header->magic)) != 0
+            || header->version != EPHEMERIS_VERSION || header->bodyRecordSize != sizeof(EphemerisBody)
+            || file.getSize() < sizeof(EphemerisHeader) + (size_t)header->bodyCount * sizeof(EphemerisBody)) {
+            std::cerr << "Ephemeris " << path << " is not a version " << EPHEMERIS_VERSION << " ephemeris, ignoring it" << std::endl;
+            file.close();
+            return false;
+        }
+        const EphemerisBody* bodies = (const EphemerisBody*)(header + 1);
+        Uint32 highest = 0;
+        for (Uint32 i = 0; i < header->bodyCount; ++i) {
+            const EphemerisBody& record = bodies[i];
+            Uint64 bytes = (Uint64)record.segmentCount * 3 * (record.degree + 1) * sizeof(double);
+            if (record.segmentCount == 0 || !(record.segmentLength > 0.0) || record.degree > EPHEMERIS_MAX_DEGREE
+                || record.offset % sizeof(double) != 0 || record.offset > file.getSize() || bytes > file.getSize() - record.offset) {
+                std::cerr << "Ephemeris " << path << ": body " << i << " is malformed, ignoring the file" << std::endl;
+                file.close();
+                return false;
+            }
+            highest = std::max(highest, record.degree);
+        }
+
+        records = bodies;
+        count = header->bodyCount;
+        padded = (count + 1) & ~(size_t)1;
+        degree = highest;
+        target.assign(count, -1);
+        segment.assign(padded, EPHEMERIS_UNCOVERED);
+        segmentStart.assign(padded, 0.0);
+        inverseHalfLength.assign(padded, 0.0);
+        for (size_t i = 0; i < count; ++i) inverseHalfLength[i] = 2.0 / records[i].segmentLength;
+        for (int axis = 0; axis < 3; ++axis) {
+            coefficients[axis].assign((size_t)(degree + 1) * padded, 0.0);
+            positions[axis].assign(padded, 0.0);
+        }
+        return true;
+    }
+
+    size_t size() const { return count; }
+    const char* name(size_t body) const { return records[body].name; }
+    int attachedBody(size_t body) const { return target[body]; }
+    void attach(size_t body, int storeBody) { target[body] = storeBody; }
+    bool covered(size_t body) const { return segment[body] != EPHEMERIS_UNCOVERED; }
+
+    // Positions of every body at an absolute time. Bodies the file doesn't cover then get
+    // nothing useful written and report covered() false. The outputs need room for size()
+    // rounded up to even.
+    void evaluate(double time, double* x, double* y, double* z) {
+        for (size_t i = 0; i < count; ++i) select(i, time);
+
+        const __m128d one = _mm_set1_pd(1.0);
+        __m128d t = _mm_set1_pd(time);
+        double* outputs[3] = { x, y, z };
+        for (size_t i = 0; i < padded; i += 2) {
+            // Segment time mapped onto [-1, 1]
+            __m128d tau = _mm_sub_pd(_mm_mul_pd(_mm_sub_pd(t, _mm_loadu_pd(&segmentStart[i])), _mm_loadu_pd(&inverseHalfLength[i])), one);
+            __m128d twoTau = _mm_add_pd(tau, tau);
+            for (int axis = 0; axis < 3; ++axis) {
+                const double* c = coefficients[axis].data() + i;
+                __m128d b1 = _mm_setzero_pd(), b2 = _mm_setzero_pd();
+                for (Uint32 order = degree; order >= 1; --order) {
+                    __m128d b0 = _mm_sub_pd(_mm_add_pd(_mm_loadu_pd(c + order * padded), _mm_mul_pd(twoTau, b1)), b2);
+                    b2 = b1;
+                    b1 = b0;
+                }
+                __m128d value = _mm_sub_pd(_mm_add_pd(_mm_loadu_pd(c), _mm_mul_pd(tau, b1)), b2);
+                _mm_storeu_pd(outputs[axis] + i, value);
+            }
+        }
+    }
+
+    // Same into the ephemeris's own buffers, read back through position()
+    void evaluate(double time) { evaluate(time, positions[0].data(), positions[1].data(), positions[2].data()); }
+    double position(size_t body, int axis) const { return positions[axis][body]; }
+};
+
+// Render state captured from the bodies each simulation tick. The render thread only ever
+// reads these snapshots, never the live objects, so it can run at its own rate.
+struct MoonState {
+    double offsetX, offsetY, offsetZ;   // From the planet
+    float orbitAngle;                   // Longitude around the planet, degrees; the moon keeps one face towards it
+    float size;
+    GLuint textureID, atmosphereTextureID;
+};
+
+struct PlanetState {
+    double positionX, positionY, positionZ; // World space; only the camera-relative offset is rounded to float
+    float rotationY, userRotationX, userRotationY;
+    float radius, atmosphereRadius;
+    GLuint textureID, atmosphereTextureID;
+    GLuint materialTextureID;       // Packed ocean mask / night lights, 0 for plain diffuse
+    float ringInnerRadius, ringOuterRadius;
+    GLuint ringTextureID;           // 0 when the planet has no rings
+};
+
+struct SunState {
+    float radius;
+    GLuint textureID;
+};
+
+// Renderer toggles. Input changes the main thread's copy; each snapshot carries its own.
+struct RenderSettings {
+    bool bloom = true;
+    bool bloomHalfResolution = true;  // Run the bloom chain at half its normal resolution (cheaper on integrated GPUs)
+    bool dynamicResolution = true;
+    bool profilerOverlay = false;     // On-screen GPU pass timings
+    bool ringDebris = true;           // Instanced debris particles near the camera
+    bool temporalAA = true;           // Jittered rendering resolved against reprojected history
+    bool temporalUpsampling = false;  // Render below output resolution and let TAA fill in the rest
+    int atmosphereDownsample = 2;     // Atmosphere shell resolution divisor per axis: 1, 2 or 4
+};
+
+// Everything the render thread needs to draw one frame
+struct SceneSnapshot {
+    Uint64 sequence = 0;           // Simulation tick that produced this snapshot
+    double simTime = 0.0;          // Seconds of simulated time
+    Uint64 publishTicks = 0;       // Performance counter when published, for render interpolation
+    double cameraEye[3] = {};
+    double cameraTarget[3] = {};
+    SunState sun = {};
+    PlanetState planet = {};
+    bool hasMoon = false;
+    MoonState moon = {};
+    RenderSettings settings;
+};
+
+// Camera for one frame. World positions stay in double precision and only offsets from the eye
+// are rounded to float, so vertex precision is set by distance from the camera rather than
+// from the world origin.
+struct CameraFrame {
+    double eye[3];
+    Mat4 rotation;  // View rotation only, with the eye at the origin
+
+    // Model-view for something placed at a world position
+    Mat4 relativeTo(double x, double y, double z) const {
+        return rotation * Mat4::translation((float)(x - eye[0]), (float)(y - eye[1]), (float)(z - eye[2]));
+    }
+};
+
+// Bodies that can cast shadows this frame, as view-space spheres. Shadows themselves are
+// analytic in the body shader; this is only the CPU broad phase that picks, per receiver,
+// the occluders whose penumbra cone can reach it.
+const int SHADOW_CASTER_PLANET = 0;
+const int SHADOW_CASTER_MOON = 1;
+
+struct ShadowCasters {
+    float sun[4];       // Centre and radius
+    float bodies[2][4];
+    bool active[2];
+
+    ShadowSet select(const float center[3], float radius, int self) const {
+        ShadowSet set;
+        for (int i = 0; i < 2; ++i) {
+            if (!active[i] || i == self) continue;
+            const float* occluder = bodies[i];
+
+            // Shadow axis from the sun through the occluder
+            float axis[3] = { occluder[0] - sun[0], occluder[1] - sun[1], occluder[2] - sun[2] };
+            float axisLength = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+            if (axisLength <= sun[3] + occluder[3]) continue;
+            float offset[3] = { center[0] - occluder[0], center[1] - occluder[1], center[2] - occluder[2] };
+            float along = (offset[0] * axis[0] + offset[1] * axis[1] + offset[2] * axis[2]) / axisLength;
+            if (along + radius <= 0.0f) continue; // Receiver is entirely on the sun's side
+
+            // Penumbra cone: bounded by the lines tangent to both spheres on opposite sides
+            float sinHalfAngle = (sun[3] + occluder[3]) / axisLength;
+            float cosHalfAngle = sqrtf(1.0f - sinHalfAngle * sinHalfAngle);
+            float penumbraRadius = occluder[3] / cosHalfAngle + std::max(along, 0.0f) * sinHalfAngle / cosHalfAngle;
+            float across[3] = { offset[0] - axis[0] * along / axisLength, offset[1] - axis[1] * along / axisLength,
+                offset[2] - axis[2] * along / axisLength };
+            float distance = sqrtf(across[0] * across[0] + across[1] * across[1] + across[2] * across[2]);
+            if (distance > penumbraRadius + radius) continue;
+
+            memcpy(set.spheres[set.count++], occluder, sizeof(set.spheres[0]));
+        }
+        return set;
+    }
+};
+
+// Lock-free single-producer/single-consumer triple buffer. The writer always has a private
+// slot to fill, the reader always has a private slot to draw, and the third slot is swapped
+// between them through one atomic word whose high bit marks "newer than what the reader has".
+// Neither side ever blocks, and the reader always gets the most recently published value.
+template <typename T>
+class TripleBuffer {
+protected:
+    static const unsigned FRESH_BIT = 4;
+    static const unsigned INDEX_MASK = 3;
+
+    T buffers[3];
+    std::atomic<unsigned> shared;
+    unsigned writeIndex, readIndex;
+
+public:
+    TripleBuffer() : shared(1), writeIndex(0), readIndex(2) {}
+
+    // Producer side
+    T& writeBuffer() { return buffers[writeIndex]; }
+    void publish() {
+        writeIndex = shared.exchange(writeIndex | FRESH_BIT, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // Consumer side. Returns true if a newer value was picked up.
+    bool acquire() {
+        if (!(shared.load(std::memory_order_relaxed) & FRESH_BIT)) return false;
+        readIndex = shared.exchange(readIndex, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+    const T& readBuffer() const { return buffers[readIndex]; }
+};
+
+// Work-stealing job system. Each worker owns a deque: it pushes and pops its own jobs at the
+// back, newest first, and when that runs dry it steals the oldest job from the front of
+// another's. Threads outside the pool share deque 0. Completion is tracked with counters: a
+// job can signal a counter when it finishes and can be held back until another counter drains,
+// which is enough to chain the stages of a frame. Waiting on a counter runs jobs meanwhile.
+struct Job;
+
+struct JobCounter {
+    std::atomic<int> pending;
+    std::mutex lock;            // Guards parked, and every decrement, so a drained counter can go out of scope safely
+    std::vector<Job*> parked;   // Jobs held until pending reaches zero
+    JobCounter() : pending(0) {}
+};
+
+struct Job {
+    std::function<void()> work;
+    JobCounter* signal;         // Decremented once work returns, may be null
+};
+
+thread_local int jobQueueIndex = 0; // Deque owned by the current thread
+
+class JobSystem {
+protected:
+    struct Queue {
+        std::mutex lock;
+        std::deque<Job*> jobs;
+    };
+
+    std::deque<Queue> queues;   // Queue 0 for outside threads, then one per worker; deque keeps them in place
+    std::vector<std::thread> workers;
+    std::atomic<bool> running;
+    std::atomic<int> queued;    // Jobs sitting in any deque, so idle workers know when to sleep
+    std::mutex sleepLock;
+    std::condition_variable wake;
+
+    void push(Job* job) {
+        Queue& queue = queues[jobQueueIndex];
+        {
+            std::lock_guard<std::mutex> guard(queue.lock);
+            queue.jobs.push_back(job);
+        }
+        ++queued;
+        { std::lock_guard<std::mutex> guard(sleepLock); } // A worker between its check and its wait still gets the notify
+        wake.notify_one();
+    }
+
+    // Own deque from the back, else steal from the front of the others in turn
+    Job* pop() {
+        size_t own = jobQueueIndex;
+        for (size_t i = 0; i < queues.size(); ++i) {
+            Queue& queue = queues[(own + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            if (queue.jobs.empty()) continue;
+            Job* job;
+            if (i == 0) {
+                job = queue.jobs.back();
+                queue.jobs.pop_back();
+            }
+            else {
+                job = queue.jobs.front();
+                queue.jobs.pop_front();
+            }
+            --queued;
+            return job;
+        }
+        return nullptr;
+    }
+
+    void execute(Job* job) {
+        job->work();
+        if (job->signal) finish(*job->signal);
+        delete job;
+    }
+
+    void finish(JobCounter& counter) {
+        std::vector<Job*> ready;
+        {
+            std::lock_guard<std::mutex> guard(counter.lock);
+            if (--counter.pending == 0) ready.swap(counter.parked);
+        }
+        for (Job* job : ready) push(job);
+    }
+
+    void workerMain(int index) {
+        jobQueueIndex = index;
+        while (running) {
+            Job* job = pop();
+            if (job) {
+                execute(job);
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(sleepLock);
+            wake.wait(guard, [this]() { return queued > 0 || !running; });
+        }
+    }
+
+public:
+    JobSystem() : queues(1), running(false), queued(0) {}
+    ~JobSystem() { stop(); } // For exit() paths that never reach the cleanup
+
+    // Workers on top of the calling thread; with none, jobs run on whichever thread waits
+    void start(unsigned count) {
+        for (unsigned i = 0; i < count; ++i) queues.emplace_back();
+        running = true;
+        for (unsigned i = 0; i < count; ++i) workers.emplace_back(&JobSystem::workerMain, this, (int)i + 1);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            running = false;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) worker.join();
+        workers.clear();
+    }
+
+    size_t workerCount() const { return workers.size(); }
+
+    // Queue work, counted on signal, to start once after (if given) has drained
+    void run(std::function<void()> work, JobCounter* signal = nullptr, JobCounter* after = nullptr) {
+        Job* job = new Job{ std::move(work), signal };
+        if (signal) ++signal->pending;
+        if (after) {
+            std::lock_guard<std::mutex> guard(after->lock);
+            if (after->pending > 0) {
+                after->parked.push_back(job);
+                return;
+            }
+        }
+        push(job);
+    }
+
+    // Run jobs until counter drains
+    void wait(JobCounter& counter) {
+        while (counter.pending > 0) {
+            Job* job = pop();
+            if (job) execute(job);
+            else std::this_thread::yield();
+        }
+        std::lock_guard<std::mutex> guard(counter.lock); // The last finish() has let go of it
+    }
+};
+
+JobSystem jobSystem;
+
+// Run body(begin, end) over [0, count) in chunks of grain on the job system. The caller takes
+// the first chunk itself and helps with the rest, so this nests inside jobs without stalling.
+template <typename Function>
+void parallelFor(size_t count, size_t grain, const Function& body) {
+    if (count == 0) return;
+    size_t chunks = (count + grain - 1) / grain;
+    if (chunks == 1 || jobSystem.workerCount() == 0) {
+        body((size_t)0, count);
+        return;
+    }
+    JobCounter done;
+    for (size_t chunk = 1; chunk < chunks; ++chunk) {
+        size_t begin = chunk * grain, end = std::min(count, begin + grain);
+        jobSystem.run([&body, begin, end]() { body(begin, end); }, &done);
+    }
+    body((size_t)0, std::min(count, grain));
+    jobSystem.wait(done);
+}
+
+// Body storage. A body is an index into parallel component arrays rather than an object:
+// hierarchy links, orbits, transforms and render data each live in their own contiguous array,
+// and the systems below each sweep one or two of them from start to end. Bodies are only ever
+// appended, and a parent must exist before its children, so the arrays are a flattened
+// transform graph in topological order: one forward pass updates any depth.
+enum BodyKind {
+    BODY_SUN,
+    BODY_PLANET,
+    BODY_MOON
+};
+
+struct BodyStore {
+    size_t count = 0;
+
+    // Hierarchy
+    std::vector<int> parent;            // -1 for roots, which sit at the origin
+    std::vector<unsigned char> kind;    // BodyKind
+
+    // Orbit around the parent. Every body has one (roots a zero orbit), so the orbit arrays are
+    // indexed by body and the solver output needs no scatter. Offsets are padded to SIMD pairs.
+    OrbitBatch orbits;
+    std::vector<double> offsetX, offsetY, offsetZ;
+
+    // Transform. A child takes its parent's position but not its rotation, since orbits are in
+    // the parent's non-rotating frame, so a world transform is the world position (double, to
+    // keep 1 AU scenes exact) and the spin angle; the renderer builds matrices from the
+    // interpolated snapshot. Positions are only recomputed for bodies marked dirty and the
+    // bodies below them; nothing is redone while time stands still.
+    std::vector<double> positionX, positionY, positionZ;   // World space
+    std::vector<float> spinRate;        // Degrees per second about +Y
+    std::vector<float> spinAngle;       // Degrees
+    std::vector<unsigned char> tidallyLocked; // Turns with its orbit to keep one face to the parent; spinRate unused
+    std::vector<unsigned char> dirty;   // Offset changed since the last transform pass
+    double orbitTime = NAN, spinTime = NAN, ephemerisTime = NAN; // Times the offsets and spins were last evaluated for
+
+    // Render data
+    std::vector<float> radius, shellRadius;                 // Shell radius 0 for no atmosphere
+    std::vector<GLuint> texture, shellTexture, materialTexture;
+    std::vector<float> ringInnerRadius, ringOuterRadius;
+    std::vector<GLuint> ringTexture;    // 0 for no rings
+
+    int create(BodyKind bodyKind, int parentBody, const OrbitalElements& orbit, float bodyRadius, GLuint bodyTexture) {
+        if (parentBody >= (int)count) {
+            std::cerr << "Body parent " << parentBody << " does not exist yet; attaching to the root" << std::endl;
+            parentBody = -1;
+        }
+        parent.push_back(parentBody);
+        kind.push_back((unsigned char)bodyKind);
+        orbits.add(orbit);
+        size_t padded = (orbits.size() + 1) & ~(size_t)1;
+        offsetX.resize(padded, 0.0);
+        offsetY.resize(padded, 0.0);
+        offsetZ.resize(padded, 0.0);
+        positionX.push_back(0.0);
+        positionY.push_back(0.0);
+        positionZ.push_back(0.0);
+        spinRate.push_back(0.0f);
+        spinAngle.push_back(0.0f);
+        tidallyLocked.push_back(0);
+        dirty.push_back(1);
+        orbitTime = spinTime = ephemerisTime = NAN; // Its offset and spin are not evaluated yet
+        radius.push_back(bodyRadius);
+        shellRadius.push_back(0.0f);
+        texture.push_back(bodyTexture);
+        shellTexture.push_back(0);
+        materialTexture.push_back(0);
+        ringInnerRadius.push_back(0.0f);
+        ringOuterRadius.push_back(0.0f);
+        ringTexture.push_back(0);
+        return (int)count++;
+    }
+
+    void setAtmosphere(int body, float atmosphereRadius, GLuint atmosphereTexture) {
+        shellRadius[body] = atmosphereRadius;
+        shellTexture[body] = atmosphereTexture;
+    }
+
+    void setRings(int body, float innerRadius, float outerRadius, GLuint rings) {
+        ringInnerRadius[body] = innerRadius;
+        ringOuterRadius[body] = outerRadius;
+        ringTexture[body] = rings;
+    }
+};
+
+// Systems. Each takes the whole store and the absolute simulated time, and everything they
+// compute is a function of that time, so running them again for the same time gives the same
+// result. The times they last ran for only let them skip work that would change nothing.
+
+// Orbit offsets from each parent, two bodies per SIMD step, in ranges across the job system.
+// Moving orbits mark their bodies dirty for the transform pass.
+void updateOrbitSystem(BodyStore& bodies, double time) {
+    if (time == bodies.orbitTime) return;
+    bodies.orbitTime = time;
+    size_t pairs = (bodies.count + 1) / 2;
+    parallelFor(pairs, ORBIT_GRAIN_PAIRS, [&](size_t begin, size_t end) {
+        size_t first = 2 * begin, last = std::min(bodies.count, 2 * end);
+        bodies.orbits.propagate(time, bodies.offsetX.data(), bodies.offsetY.data(), bodies.offsetZ.data(), first, last);
+        for (size_t i = first; i < last; ++i) {
+            if (bodies.orbits.moves(i)) bodies.dirty[i] = 1;
+        }
+    });
+}
+
+// Spin angles straight from time, so they never drift either. Tidally locked bodies are
+// turned by the transform pass instead, once their offsets are known.
+void updateSpinSystem(BodyStore& bodies, double time) {
+    if (time == bodies.spinTime) return;
+    bodies.spinTime = time;
+    for (size_t i = 0; i < bodies.count; ++i) {
+        if (bodies.spinRate[i] == 0.0f || bodies.tidallyLocked[i]) continue;
+        bodies.spinAngle[i] = (float)fmod(bodies.spinRate[i] * time, 360.0);
+    }
+}
+
+// World positions of dirty bodies and everything below them. Parents precede children, so a
+// parent's flag is final by the time its children read it and one forward pass covers any
+// depth; the flags are cleared in a second pass.
+void updateTransformSystem(BodyStore& bodies) {
+    for (size_t i = 0; i < bodies.count; ++i) {
+        int p = bodies.parent[i];
+        if (p >= 0 && bodies.dirty[p]) bodies.dirty[i] = 1;
+        if (!bodies.dirty[i]) continue;
+
+        double baseX = p < 0 ? 0.0 : bodies.positionX[p];
+        double baseY = p < 0 ? 0.0 : bodies.positionY[p];
+        double baseZ = p < 0 ? 0.0 : bodies.positionZ[p];
+        bodies.positionX[i] = baseX + bodies.offsetX[i];
+        bodies.positionY[i] = baseY + bodies.offsetY[i];
+        bodies.positionZ[i] = baseZ + bodies.offsetZ[i];
+
+        // Same sense as a rotation about +Y, so rotating by it turns the -X face to the parent
+        if (bodies.tidallyLocked[i]) {
+            bodies.spinAngle[i] = (float)(atan2(-bodies.offsetZ[i], bodies.offsetX[i]) * 180.0 / M_PI);
+        }
+    }
+    std::fill(bodies.dirty.begin(), bodies.dirty.end(), (unsigned char)0);
+}
+
+// Offsets from the ephemeris for the bodies attached to it, in place of their Kepler orbits,
+// wherever the file covers the time. Runs after the orbit system; outside the file's span the
+// orbit's offsets stand.
+void updateEphemerisSystem(BodyStore& bodies, Ephemeris& ephemeris, double time) {
+    if (ephemeris.size() == 0 || time == bodies.ephemerisTime) return;
+    bodies.ephemerisTime = time;
+    ephemeris.evaluate(time);
+    for (size_t i = 0; i < ephemeris.size(); ++i) {
+        int body = ephemeris.attachedBody(i);
+        if (body < 0 || !ephemeris.covered(i)) continue;
+        bodies.offsetX[body] = ephemeris.position(i, 0);
+        bodies.offsetY[body] = ephemeris.position(i, 1);
+        bodies.offsetZ[body] = ephemeris.position(i, 2);
+        bodies.dirty[body] = 1;
+    }
+}
+
+void updateBodies(BodyStore& bodies, double time, Ephemeris* ephemeris = nullptr) {
+    updateOrbitSystem(bodies, time);
+    if (ephemeris) updateEphemerisSystem(bodies, *ephemeris, time);
+    updateSpinSystem(bodies, time);
+    updateTransformSystem(bodies);
+}
+
+// The bodies a snapshot describes, and the user's hold on the planet the camera follows
+struct SceneFocus {
+    int sun = -1, planet = -1, moon = -1;  // Body indices; moon is -1 when there is none
+    float zoom = 5.0f;
+    float userRotationX = 0.0f, userRotationY = 0.0f;
+
+    void setRotation(float rotX, float rotY) {
+        userRotationX = rotX;
+        userRotationY = rotY;
+    }
+
+    // Level the user's tilt back out once they have left it alone for a while
+    void update(double dt) {
+        Uint32 currentTime = sessionMilliseconds;
+        if (currentTime - lastInteractionTime >= RETURN_TO_ORIGINAL_DELAY && userRotationX != 0.0f) {
+            float step = 30.0f * (float)dt; // Degrees per second back to level
+            if (fabs(userRotationX) <= step) userRotationX = 0.0f; // Snap to zero
+            else userRotationX -= userRotationX > 0.0f ? step : -step;
+        }
+    }
+};
+
+// Write the focused bodies' render state into a snapshot
+void captureScene(const BodyStore& bodies, const SceneFocus& focus, SceneSnapshot& snapshot) {
+    int sun = focus.sun, planet = focus.planet, moon = focus.moon;
+    snapshot.sun.radius = bodies.radius[sun];
+    snapshot.sun.textureID = bodies.texture[sun];
+
+    snapshot.planet.positionX = bodies.positionX[planet];
+    snapshot.planet.positionY = bodies.positionY[planet];
+    snapshot.planet.positionZ = bodies.positionZ[planet];
+    snapshot.planet.rotationY = bodies.spinAngle[planet];
+    snapshot.planet.userRotationX = focus.userRotationX;
+    snapshot.planet.userRotationY = focus.userRotationY;
+    snapshot.planet.radius = bodies.radius[planet];
+    snapshot.planet.atmosphereRadius = bodies.shellRadius[planet];
+    snapshot.planet.textureID = bodies.texture[planet];
+    snapshot.planet.atmosphereTextureID = bodies.shellTexture[planet];
+    snapshot.planet.materialTextureID = bodies.materialTexture[planet];
+    snapshot.planet.ringInnerRadius = bodies.ringInnerRadius[planet];
+    snapshot.planet.ringOuterRadius = bodies.ringOuterRadius[planet];
+    snapshot.planet.ringTextureID = bodies.ringTexture[planet];
+
+    // Camera follows the planet
+    snapshot.cameraEye[0] = bodies.positionX[planet];
+    snapshot.cameraEye[1] = bodies.positionY[planet];
+    snapshot.cameraEye[2] = bodies.positionZ[planet] + focus.zoom;
+    snapshot.cameraTarget[0] = bodies.positionX[planet];
+    snapshot.cameraTarget[1] = bodies.positionY[planet];
+    snapshot.cameraTarget[2] = bodies.positionZ[planet];
+
+    snapshot.hasMoon = moon >= 0;
+    if (snapshot.hasMoon) {
+        snapshot.moon.offsetX = bodies.positionX[moon] - bodies.positionX[planet];
+        snapshot.moon.offsetY = bodies.positionY[moon] - bodies.positionY[planet];
+        snapshot.moon.offsetZ = bodies.positionZ[moon] - bodies.positionZ[planet];
+        snapshot.moon.orbitAngle = bodies.spinAngle[moon]; // Tidally locked, so this is its longitude around the planet
+        snapshot.moon.size = bodies.radius[moon];
+        snapshot.moon.textureID = bodies.texture[moon];
+        snapshot.moon.atmosphereTextureID = bodies.shellTexture[moon];
+    }
+}
+
+// Drawing for each kind of body, from snapshot state only
+class Moon {
+public:
+    static Mat4 modelView(const MoonState& state, const PlanetState& planet, const CameraFrame& camera) {
+        return camera.relativeTo(planet.positionX + state.offsetX, planet.positionY + state.offsetY, planet.positionZ + state.offsetZ)
+            * Mat4::rotation(state.orbitAngle, 0.0f, 1.0f, 0.0f);  // Tidally locked
+    }
+
+    static void render(const MoonState& state, const PlanetState& planet, const CameraFrame& camera, const ShadowCasters& casters) {
+        Mat4 moonModelView = modelView(state, planet, camera);
+        ShadowSet shadows = casters.select(&moonModelView.m[12], state.size + 0.05f, SHADOW_CASTER_MOON);
+
+        // Render the moon
+        drawBodySphere(moonModelView, MOTION_MOON, state.size, 30, 30, state.textureID, 0.0f, &shadows);
+    }
+
+    // The moon's atmosphere, drawn with the other translucent shells after all opaque bodies
+    static void renderAtmosphere(const MoonState& state, const PlanetState& planet, const CameraFrame& camera, const ShadowCasters& casters) {
+        Mat4 moonModelView = modelView(state, planet, camera);
+        ShadowSet shadows = casters.select(&moonModelView.m[12], state.size + 0.05f, SHADOW_CASTER_MOON);
+        Mat4 atmosphereModelView = moonModelView * Mat4::rotation(state.orbitAngle * 0.5f, 0.0f, 1.0f, 0.0f); // Atmosphere rotates slower
+        drawBodySphere(atmosphereModelView, MOTION_MOON_ATMOSPHERE, state.size + 0.05f, 30, 30, state.atmosphereTextureID, 0.0f, &shadows, 0, 0.5f);  // Slightly larger, translucent
+    }
+};
+
+class Planet {
+public:
+    static Mat4 modelView(const PlanetState& state, const CameraFrame& camera) {
+        return camera.relativeTo(state.positionX, state.positionY, state.positionZ)
+            * Mat4::rotation(state.userRotationX, 1.0f, 0.0f, 0.0f) // User-controlled rotation
+            * Mat4::rotation(state.userRotationY, 0.0f, 1.0f, 0.0f) // User-controlled rotation
+            * Mat4::rotation(state.rotationY, 0.0f, 1.0f, 0.0f);    // Passive rotation
+    }
+
+    // Rings follow the planet's tilt but not its spin
+    static Mat4 ringModelView(const PlanetState& state, const CameraFrame& camera) {
+        return modelView(state, camera) * Mat4::rotation(-state.rotationY, 0.0f, 1.0f, 0.0f);
+    }
+
+    static void render(const PlanetState& state, const MoonState* moon, const CameraFrame& camera, const ShadowCasters& casters) {
+        // Render the planet
+        Mat4 planetModelView = modelView(state, camera);
+        ShadowSet shadows = casters.select(&planetModelView.m[12], state.atmosphereRadius, SHADOW_CASTER_PLANET);
+
+        gpuProfiler.begin(GPU_PASS_PLANET);
+        drawBodySphere(planetModelView * POLE_UP, MOTION_PLANET, state.radius, 40, 40, state.textureID, 0.0f, &shadows, state.materialTextureID);
+        gpuProfiler.end(GPU_PASS_PLANET);
+
+        // Render the moon relative to the planet
+        if (moon) {
+            gpuProfiler.begin(GPU_PASS_MOON);
+            Moon::render(*moon, state, camera, casters);
+            gpuProfiler.end(GPU_PASS_MOON);
+        }
+    }
+
+    // Translucent shells for the planet and its moon, after every opaque body (see renderAtmospheres)
+    static void renderAtmospheres(const PlanetState& state, const MoonState* moon, const CameraFrame& camera, const ShadowCasters& casters) {
+        Mat4 planetModelView = modelView(state, camera);
+        ShadowSet shadows = casters.select(&planetModelView.m[12], state.atmosphereRadius, SHADOW_CASTER_PLANET);
+
+        Mat4 atmosphereModelView = planetModelView * Mat4::rotation(state.rotationY + 5.0f, 0.0f, 1.0f, 0.0f); // Atmosphere rotates based on passive rotation
+        drawBodySphere(atmosphereModelView * POLE_UP, MOTION_PLANET_ATMOSPHERE, state.atmosphereRadius, 40, 40, state.atmosphereTextureID, 0.0f, &shadows, 0, 0.5f); // Translucent
+
+        if (moon) {
+            Moon::renderAtmosphere(*moon, state, camera, casters);
+        }
+    }
+
+    // Rings last: they're translucent and don't write depth
+    static void renderRings(const PlanetState& state, const CameraFrame& camera, const ShadowCasters& casters) {
+        if (state.ringTextureID && ringSystem.annulusIndexCount > 0) {
+            gpuProfiler.begin(GPU_PASS_RINGS);
+            Mat4 rings = ringModelView(state, camera);
+            ShadowSet ringShadows = casters.select(&rings.m[12], state.ringOuterRadius, -1); // The planet shadows its own rings
+            drawRingAnnulus(rings, state.ringTextureID, ringShadows);
+            gpuProfiler.end(GPU_PASS_RINGS);
+        }
+    }
+
+    // gluSphere builds around Z; this stands the texture's poles up along Y
+    static const Mat4 POLE_UP;
+};
+
+const Mat4 Planet::POLE_UP = Mat4::rotation(90.0f, 1.0f, 0.0f, 0.0f);
+
+class Sun {
+public:
+    static void render(const SunState& state, const CameraFrame& camera) {
+        // Emissive: unlit and, with the HDR target, scaled well above 1.0 so the bloom chain picks it up
+        gpuProfiler.begin(GPU_PASS_SUN);
+        float emissive = glCaps.postProcessing ? SUN_INTENSITY : 1.0f;
+        if (!bodyProgram) glDisable(GL_LIGHTING); // The light sits inside the sun
+        drawBodySphere(camera.relativeTo(0.0, 0.0, 0.0) * Planet::POLE_UP, MOTION_SUN, state.radius, 40, 40, state.textureID, emissive);
+        if (!bodyProgram) glEnable(GL_LIGHTING);
+        gpuProfiler.end(GPU_PASS_SUN);
+    }
+};
+
+// View-space spheres of everything that can cast a shadow this frame
+ShadowCasters gatherShadowCasters(const SceneSnapshot& snapshot, const CameraFrame& camera) {
+    ShadowCasters casters = {};
+    Mat4 sunModelView = camera.relativeTo(0.0, 0.0, 0.0);
+    memcpy(casters.sun, &sunModelView.m[12], 3 * sizeof(float));
+    casters.sun[3] = snapshot.sun.radius;
+
+    Mat4 planetModelView = Planet::modelView(snapshot.planet, camera);
+    memcpy(casters.bodies[SHADOW_CASTER_PLANET], &planetModelView.m[12], 3 * sizeof(float));
+    casters.bodies[SHADOW_CASTER_PLANET][3] = snapshot.planet.radius;
+    casters.active[SHADOW_CASTER_PLANET] = true;
+
+    if (snapshot.hasMoon) {
+        Mat4 moonModelView = Moon::modelView(snapshot.moon, snapshot.planet, camera);
+        memcpy(casters.bodies[SHADOW_CASTER_MOON], &moonModelView.m[12], 3 * sizeof(float));
+        casters.bodies[SHADOW_CASTER_MOON][3] = snapshot.moon.size;
+        casters.active[SHADOW_CASTER_MOON] = true;
+    }
+    return casters;
+}
+
+// Startup timings, printed once before the render thread starts
+struct StartupMetrics {
+    double shaderMs = 0.0;      // Building every shader program, cached or not
+    int programsCached = 0;     // Loaded from the binary cache
+    int programsCompiled = 0;   // Compiled from source (cold start, driver change or no cache support)
+};
+StartupMetrics startupMetrics;
+
+// Planet material packed on the CPU, waiting for its upload (two bytes per texel)
+struct MaterialImage {
+    int width = 0, height = 0;
+    std::vector<Uint8> packed;
+};
+
+// Barnes-Hut octree over the N-body system. Nodes are stored flat; the children of a node
+// are consecutive, and a node's bodies are a contiguous range of the Morton-sorted order.
+struct OctreeNode {
+    double centerOfMass[3];
+    double mass;
+    double size;                // Edge of the node's cube
+    int firstChild, childCount; // firstChild -1 for a leaf
+    int firstBody, bodyCount;   // Range in NBodySystem::order
+};
+
+// N-body mode (--nbody N): a sun and a belt of asteroids under mutual gravity, in structure-
+// of-arrays form. G is 1 in scene units.
+struct NBodySystem {
+    size_t count = 0;
+    std::vector<double> x, y, z, vx, vy, vz, ax, ay, az;
+    std::vector<double> mass, potential;
+    std::vector<float> radius;  // For drawing only
+    double theta = NBODY_DEFAULT_THETA;
+    double time = 0.0;
+    bool accelerationsValid = false;
+
+    // Tree, rebuilt every step
+    std::vector<Uint64> keys;   // Morton code above NBODY_INDEX_BITS, body index below, sorted
+    std::vector<int> order;     // Body indices in Morton order
+    std::vector<double> sortedX, sortedY, sortedZ, sortedMass; // Copies in Morton order, so leaves are contiguous
+    std::vector<OctreeNode> nodes;
+    std::vector<int> groups;    // Nodes that share one tree walk in the force pass
+    double boundsMin[3] = {}, boundsSize = 0.0;
+
+    // Diagnostics
+    double initialEnergy = 0.0;
+    Uint64 lastReportTicks = 0;
+    double buildMs = 0.0, forceMs = 0.0;
+    int stepsSinceReport = 0;
+
+    // Adaptive substeps under time warp
+    double stableStep = NBODY_MAX_STEP;   // From the largest acceleration at the last force pass
+    std::vector<double> chunkMaxAcceleration;
+    int substepsTaken = 0;                // By the last advance, for session recording
+    double requestedTime = 0.0, advancedTime = 0.0; // Since the last report, for the effective warp
+};
+
+// Snapshots flow from the main (simulation) thread to the render thread through this buffer
+TripleBuffer<SceneSnapshot> sceneBuffer;
+TripleBuffer<std::vector<float>> nbodyPositions; // N-body asteroids, vec4 centre + radius each, per step
+std::atomic<bool> renderThreadRunning(false);
+RenderSettings renderSettings; // Main thread's copy, edited by input
+
+// Time warp, edited by input on the main thread. The window title shows the rate.
+struct TimeWarp {
+    double rate = 1.0;          // Simulated seconds per real second, 0 when paused
+    double resumeRate = 1.0;    // What unpausing returns to
+    double shownRate = 1.0;     // Rate in the window title
+
+    void set(double newRate) {
+        rate = std::min(std::max(newRate, 0.0), TIME_WARP_MAX);
+    }
+
+    void showIn(SDL_Window* window) {
+        if (rate == shownRate) return;
+        shownRate = rate;
+        char title[128];
+        if (rate == 0.0) snprintf(title, sizeof(title), "%s - paused", WINDOW_TITLE);
+        else if (rate == 1.0) snprintf(title, sizeof(title), "%s", WINDOW_TITLE);
+        else snprintf(title, sizeof(title), "%s - time warp %gx", WINDOW_TITLE, rate);
+        SDL_SetWindowTitle(window, title);
+    }
+    void faster() { set(rate == 0.0 ? 1.0 : rate * 10.0); }
+    void slower() { set(rate <= 1.0 ? 0.0 : rate / 10.0); }
+    void togglePause() {
+        if (rate > 0.0) resumeRate = rate;
+        set(rate > 0.0 ? 0.0 : resumeRate);
+    }
+};
+TimeWarp timeWarp;
+
+// Session log, written by --record and read by --replay. A header, then one SessionFrame per
+// main loop pass: the performance counter ticks since the previous pass and the simulation
+// steps run in it, followed by the input events handled in it and, with the N-body belt on,
+// the substeps each simulation step took. Replaying feeds these back in place of the real
+// clock, live input and the CPU budgets, so a session simulates identically on any machine
+// and build. Little-endian.
+const char SESSION_MAGIC[4] = { 'S', 'E', 'S', 'N' };
+const Uint32 SESSION_VERSION = 2;
+
+struct SessionHeader {
+    char magic[4];
+    Uint32 version;
+    Uint64 frequency;       // Performance counter ticks per second on the recording machine
+    double simulationHz;    // Replays step at the recorded rate
+    double timeWarp;        // Starting rate
+};
+
+struct SessionFrame {
+    Uint32 deltaTicks;
+    Uint16 stepCount;       // Simulation steps, which the pass budget can cut short
+    Uint16 eventCount;      // SessionEvent records that follow
+    Uint16 substepCount;    // Uint32 substep counts after those, one per simulation step
+    Uint16 pad;
+};
+
+// Only the fields handleInput reads
+struct SessionEvent {
+    Uint32 type;
+    Sint32 x, y;            // Mouse motion and buttons
+    Sint32 value;           // Button, wheel y or key sym
+};
+
+class Session {
+protected:
+    FILE* output;                       // While recording
+    MappedFile input;                   // While replaying
+    const char* cursor;
+    const char* end;
+    SessionHeader header;
+    std::vector<SessionEvent> events;   // The current frame's
+    std::vector<Uint32> substeps;
+    int steps;
+
+public:
+    Uint64 frames;
+
+    Session() : output(nullptr), cursor(nullptr), end(nullptr), header(), steps(0), frames(0) {}
+    ~Session() { close(); }
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    bool record(const char* path, Uint64 frequency, double simulationHz, double warp) {
+        close();
+        memcpy(header.magic, SESSION_MAGIC, sizeof(header.magic));
+        header.version = SESSION_VERSION;
+        header.frequency = frequency;
+        header.simulationHz = simulationHz;
+        header.timeWarp = warp;
+        output = fopen(path, "wb");
+        if (!output || fwrite(&header, sizeof(header), 1, output) != 1) {
+            std::cerr << "Could not write session " << path << std::endl;
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    // Map and validate a recording. On failure nothing is replayed and the reason is printed.
+    bool replay(const char* path) {
+        close();
+        if (!input.open(path)) {
+            std::cerr << "Session " << path << " not found" << std::endl;
+            return false;
+        }
+        if (input.getSize() < sizeof(SessionHeader) || memcmp(input.getData(), SESSION_MAGIC, sizeof(header.magic)) != 0
+            || ((const SessionHeader*)input.getData())->version != SESSION_VERSION
+            || ((const SessionHeader*)input.getData())->frequency == 0) {
+            std::cerr << "Session " << path << " is not a version " << SESSION_VERSION << " session" << std::endl;
+            close();
+            return false;
+        }
+        memcpy(&header, input.getData(), sizeof(header));
+        cursor = (const char*)input.getData() + sizeof(SessionHeader);
+        end = (const char*)input.getData() + input.getSize();
+        return true;
+    }
+
+    bool recording() const { return output != nullptr; }
+    bool replaying() const { return cursor != nullptr; }
+    const SessionHeader& info() const { return header; }
+
+    // Recording: gather a frame's input and substeps, then write it out with its duration
+    void addEvent(const SDL_Event& event) {
+        SessionEvent record = { event.type, 0, 0, 0 };
+        switch (event.type) {
+        case SDL_QUIT:
+            break;
+        case SDL_MOUSEMOTION:
+            record.x = event.motion.x;
+            record.y = event.motion.y;
+            break;
+        case SDL_MOUSEBUTTONDOWN:
+        case SDL_MOUSEBUTTONUP:
+            record.x = event.button.x;
+            record.y = event.button.y;
+            record.value = event.button.button;
+            break;
+        case SDL_MOUSEWHEEL:
+            record.value = event.wheel.y;
+            break;
+        case SDL_KEYDOWN:
+            record.value = event.key.keysym.sym;
+            break;
+        default:
+            return; // Nothing handleInput reacts to
+        }
+        if (events.size() < 0xffff) events.push_back(record);
+    }
+
+    void addSubsteps(int count) { substeps.push_back((Uint32)count); }
+
+    void endFrame(Uint32 deltaTicks, int stepCount) {
+        SessionFrame frame = { deltaTicks, (Uint16)stepCount, (Uint16)events.size(), (Uint16)std::min(substeps.size(), (size_t)0xffff), 0 };
+        bool written = fwrite(&frame, sizeof(frame), 1, output) == 1
+            && fwrite(events.data(), sizeof(SessionEvent), events.size(), output) == events.size()
+            && fwrite(substeps.data(), sizeof(Uint32), frame.substepCount, output) == frame.substepCount;
+        events.clear();
+        substeps.clear();
+        ++frames;
+        if (!written) {
+            std::cerr << "Session recording failed after " << frames << " frames, stopping it" << std::endl;
+            close();
+        }
+    }
+
+    // Replaying: load the next frame. False at the end of the log, or where it was cut short.
+    bool nextFrame(Uint64& deltaTicks) {
+        SessionFrame frame;
+        if ((size_t)(end - cursor) < sizeof(frame)) return false;
+        memcpy(&frame, cursor, sizeof(frame));
+        size_t size = sizeof(frame) + frame.eventCount * sizeof(SessionEvent) + frame.substepCount * sizeof(Uint32);
+        if ((size_t)(end - cursor) < size) return false;
+        events.resize(frame.eventCount);
+        substeps.resize(frame.substepCount);
+        memcpy(events.data(), cursor + sizeof(frame), events.size() * sizeof(SessionEvent));
+        memcpy(substeps.data(), cursor + sizeof(frame) + events.size() * sizeof(SessionEvent), substeps.size() * sizeof(Uint32));
+        cursor += size;
+        deltaTicks = frame.deltaTicks;
+        steps = frame.stepCount;
+        ++frames;
+        return true;
+    }
+
+    size_t eventCount() const { return events.size(); }
+    int stepCount() const { return steps; }
+
+    SDL_Event event(size_t i) const {
+        const SessionEvent& record = events[i];
+        SDL_Event event;
+        memset(&event, 0, sizeof(event));
+        event.type = record.type;
+        switch (record.type) {
+        case SDL_MOUSEMOTION:
+            event.motion.x = record.x;
+            event.motion.y = record.y;
+            break;
+        case SDL_MOUSEBUTTONDOWN:
+        case SDL_MOUSEBUTTONUP:
+            event.button.x = record.x;
+            event.button.y = record.y;
+            event.button.button = (Uint8)record.value;
+            break;
+        case SDL_MOUSEWHEEL:
+            event.wheel.y = record.value;
+            break;
+        case SDL_KEYDOWN:
+            event.key.keysym.sym = record.value;
+            break;
+        }
+        return event;
+    }
+
+    // Substeps the given step of the current frame took; -1 if the recording ran without the belt
+    int substepLimit(int step) const { return step < (int)substeps.size() ? (int)substeps[step] : -1; }
+
+    void close() {
+        if (output) fclose(output);
+        output = nullptr;
+        input.close();
+        cursor = end = nullptr;
+        events.clear();
+        substeps.clear();
+    }
+};
+
+// Mouse controls and variables
+float sphereRotationY = 0.0f;
+float sphereRotationX = 0.0f;
+bool dragging = false;
+int lastMouseX, lastMouseY;
+
+// Function prototypes
+void initSDL(SDL_Window*& window, SDL_GLContext& context);
+void initOpenGL();
+SDL_Surface* decodeImage(const char* filename);
+GLuint uploadTexture(SDL_Surface* surface, const char* filename);
+MaterialImage packMaterialImage(const SDL_Surface* color, const char* oceanFile, const char* lightsFile);
+GLuint uploadMaterialTexture(const MaterialImage& image);
+void handleInput(SDL_Event& event, bool& running, SceneFocus& focus);
+void cleanup(SDL_Window* window, SDL_GLContext context);
+bool loadGLExtensions();
+void initBodyRendering();
+void releaseBodyRendering();
+GLuint createProgram(const char* name, const char* vertexSource, const char* fragmentSource);
+void selectDepthMode();
+void applyDepthMode();
+GLuint createComputeProgram(const char* name, const char* source);
+std::vector<SmallBodyOrbit> generateSmallBodies(int count);
+void initBodyField(const std::vector<SmallBodyOrbit>& orbits, GLuint texture);
+void releaseBodyField();
+void initNBody(NBodySystem& system, int asteroidCount, double theta);
+void stepNBody(NBodySystem& system, double dt);
+double advanceNBody(NBodySystem& system, double dt, double budgetMs, int substepLimit = -1);
+Uint64 sessionFingerprint(const BodyStore& bodies, const SceneFocus& focus, const NBodySystem& nbody, double simTime);
+void publishNBodyPositions(const NBodySystem& system);
+int convertStarCatalog(const char* textPath, const char* binaryPath);
+void initStarField(const char* path);
+void releaseStarField();
+void initRings(float innerRadius, float outerRadius);
+void releaseRings();
+void renderRingDebris(const PlanetState& planet, const CameraFrame& camera);
+void renderStarField(const Mat4& projection, const Mat4& viewRotation);
+void renderBodyField(const SceneSnapshot& snapshot, const Mat4& view, const Mat4& projection);
+void initPostProcessing();
+void releasePostProcessing();
+void releaseTemporalAA();
+void releaseAtmosphereTarget();
+void beginHdrScene(const RenderSettings& settings);
+void renderBloom(const RenderSettings& settings);
+void compositeToBackBuffer(const RenderSettings& settings);
+void setMotionVectorOutput(bool enabled);
+void renderAtmospheres(const SceneSnapshot& snapshot, const CameraFrame& camera, const Mat4& projection, const ShadowCasters& casters);
+void runAtmosphereBenchmark(SDL_Window* window, const BodyStore& bodies, SceneFocus& focus);
+int runKeplerBenchmark();
+int runBodyBenchmark(int count);
+int buildEphemeris(const char* path, double span, double orbitRadius);
+void resolveTemporalAA();
+void drawFullscreenQuad();
+void renderScene(const SceneSnapshot& snapshot);
+SceneSnapshot interpolateSnapshots(const SceneSnapshot& older, const SceneSnapshot& newer, double t);
+void renderThreadMain(SDL_Window* window, SDL_GLContext context);
+void renderProfilerOverlay();
+float precisionTestZoom(double simTime, float planetRadius);
+
+// Main function
+int main(int argc, char* argv[]) {
+    Uint64 startupBegin = SDL_GetPerformanceCounter();
+    SDL_Window* window = nullptr;
+    SDL_GLContext context;
+
+    // Command line: --bodies N adds a GPU-driven field of N small bodies, --precision-test
+    // moves the planet out to 1 AU and repeatedly dives the camera down to its surface.
+    // --convert-stars IN OUT builds the binary star catalog and exits. --atmosphere-benchmark
+    // measures atmosphere fill at each downsample factor over a range of zooms, then exits.
+    // --sim-hz N sets the fixed simulation step rate. --kepler-benchmark times the batched
+    // Kepler solver on a large set of random orbits and exits. --body-benchmark [N] times a body
+    // update in the component store against the old one-object-per-body layout and exits.
+    // --nbody N simulates a belt of N asteroids under mutual gravity (Barnes-Hut, opening
+    // angle set by --nbody-theta) in place of the scripted small body field. --time-warp X
+    // starts the clock at X simulated seconds per real second (',' and '.' change it by factors
+    // of ten while running, space pauses). --ephemeris FILE places the planet and moon from a
+    // Chebyshev ephemeris wherever it covers the time; --build-ephemeris OUT [SECONDS] fits one
+    // to the scene's own orbits (the precision test's with --precision-test), checks it and exits. --record FILE logs the session's input
+    // and frame times; --replay FILE plays such a log back on a virtual clock in place of live
+    // input (other options must match the recording). Both end by printing a fingerprint of
+    // the final state and the simulation cost per frame, to compare runs and builds by.
+    int smallBodyCount = 0;
+    int nbodyCount = 0;
+    double nbodyTheta = NBODY_DEFAULT_THETA;
+    bool precisionTest = false;
+    bool atmosphereBenchmark = false;
+    double simulationHz = SIMULATION_HZ;
+    const char* ephemerisPath = nullptr;
+    const char* recordPath = nullptr;
+    const char* replayPath = nullptr;
+    const char* ephemerisBuildPath = nullptr;
+    double ephemerisBuildSpan = EPHEMERIS_BUILD_SPAN;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--convert-stars") == 0 && i + 2 < argc) {
+            return convertStarCatalog(argv[i + 1], argv[i + 2]);
+        }
+        if (strcmp(argv[i], "--kepler-benchmark") == 0) {
+            return runKeplerBenchmark();
+        }
+        if (strcmp(argv[i], "--build-ephemeris") == 0 && i + 1 < argc) {
+            ephemerisBuildPath = argv[++i];
+            double span = i + 1 < argc ? atof(argv[i + 1]) : 0.0;
+            if (span > 0.0) {
+                ephemerisBuildSpan = span;
+                ++i;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--body-benchmark") == 0) {
+            int count = i + 1 < argc ? atoi(argv[i + 1]) : 0;
+            return runBodyBenchmark(count > 0 ? count : BODY_BENCHMARK_BODIES);
+        }
+        if (strcmp(argv[i], "--bodies") == 0 && i + 1 < argc) {
+            smallBodyCount = std::max(0, atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--precision-test") == 0) {
+            precisionTest = true;
+        }
+        else if (strcmp(argv[i], "--atmosphere-benchmark") == 0) {
+            atmosphereBenchmark = true;
+        }
+        else if (strcmp(argv[i], "--sim-hz") == 0 && i + 1 < argc) {
+            simulationHz = std::max(1.0, atof(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--nbody") == 0 && i + 1 < argc) {
+            nbodyCount = std::max(0, atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--nbody-theta") == 0 && i + 1 < argc) {
+            nbodyTheta = std::max(0.0, atof(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--ephemeris") == 0 && i + 1 < argc) {
+            ephemerisPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--time-warp") == 0 && i + 1 < argc) {
+            timeWarp.set(atof(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        }
+    }
+
+    // The planet's semi-major axis, which an ephemeris built here has to match
+    double orbitRadius = precisionTest ? ASTRONOMICAL_UNIT : PLANET_ORBIT_RADIUS;
+    if (ephemerisBuildPath) {
+        return buildEphemeris(ephemerisBuildPath, ephemerisBuildSpan, orbitRadius);
+    }
+
+    // A replay runs at the recorded step rate and starting warp; a recording notes them
+    Session session;
+    if (replayPath) {
+        if (!session.replay(replayPath)) return 1;
+        simulationHz = session.info().simulationHz;
+        timeWarp.set(session.info().timeWarp);
+        if (recordPath) std::cerr << "Warning: --record is ignored while replaying" << std::endl;
+    }
+    else if (recordPath) {
+        session.record(recordPath, SDL_GetPerformanceFrequency(), simulationHz, timeWarp.rate);
+    }
+
+    // Initialize SDL and OpenGL
+    initSDL(window, context);
+    initOpenGL();
+    if (loadGLExtensions()) {
+        selectDepthMode();
+        initBodyRendering();
+        initPostProcessing();
+        applyDepthMode();
+    }
+    else {
+        std::cerr << "Warning: HDR pipeline unavailable (needs OpenGL 3.3), rendering without bloom" << std::endl;
+    }
+    gpuProfiler.init();
+
+    // Initialize SDL_image
+    if (!(IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG) & (IMG_INIT_PNG | IMG_INIT_JPG))) {
+        std::cerr << "SDL_image could not initialize! IMG_Error: " << IMG_GetError() << std::endl;
+        cleanup(window, context);
+        return 1;
+    }
+
+    // Worker threads for the simulation and asset jobs; this thread makes up the last core
+    jobSystem.start(std::max(1u, std::thread::hardware_concurrency()) - 1);
+
+    // Load textures. Decoding and the material packing run as jobs; the uploads stay on this
+    // thread, which owns the GL context. The sun reuses the planet's image, and the material
+    // packing reads it once it is decoded.
+    const char* imageFiles[] = { "map2.png", "clouds.png", "moon.jpg", "rings_system.jpg" };
+    const int imageCount = bodyProgram ? 4 : 3; // Rings only draw with the body program
+    SDL_Surface* images[4] = {};
+    MaterialImage material;
+    JobCounter colorDecoded, decoded;
+    for (int i = 0; i < imageCount; ++i) {
+        jobSystem.run([&images, &imageFiles, i]() { images[i] = decodeImage(imageFiles[i]); }, i == 0 ? &colorDecoded : &decoded);
+    }
+    if (bodyProgram) {
+        jobSystem.run([&material, &images]() { material = packMaterialImage(images[0], OCEAN_MASK_FILE, NIGHT_LIGHTS_FILE); }, &decoded, &colorDecoded);
+    }
+    jobSystem.wait(colorDecoded);
+    jobSystem.wait(decoded);
+    GLuint planetTexture = uploadTexture(images[0], imageFiles[0]);
+    GLuint planetAtmosphereTexture = uploadTexture(images[1], imageFiles[1]);
+    GLuint moonTexture = uploadTexture(images[2], imageFiles[2]);
+    GLuint moonAtmosphereTexture = planetAtmosphereTexture;
+    GLuint sunTexture = planetTexture;
+
+    // Bodies, parents first. The sun sits at the origin (radius 10, or the real ratio for the
+    // precision test); the planet orbits it, PLANET_ORBIT_RADIUS out or 1 AU for the precision
+    // test, and the moon orbits the planet.
+    BodyStore bodies;
+    SceneFocus focus;
+    OrbitalElements fixed = {};
+    focus.sun = bodies.create(BODY_SUN, -1, fixed, precisionTest ? PRECISION_TEST_SUN_RADIUS : 10.0f, sunTexture);
+
+    focus.planet = bodies.create(BODY_PLANET, focus.sun, planetOrbitElements(orbitRadius), 1.0f, planetTexture);
+    bodies.setAtmosphere(focus.planet, 1.05f, planetAtmosphereTexture);
+    bodies.spinRate[focus.planet] = (float)(360.0 / PLANET_ROTATION_PERIOD);
+
+    focus.moon = bodies.create(BODY_MOON, focus.planet, moonOrbitElements(), 0.27f, moonTexture);
+    bodies.tidallyLocked[focus.moon] = 1;
+    bodies.setAtmosphere(focus.moon, 0.27f + 0.05f, moonAtmosphereTexture);
+
+    // Optional ephemeris: places the bodies it names wherever it covers the time
+    Ephemeris ephemeris;
+    if (ephemerisPath && ephemeris.open(ephemerisPath)) {
+        for (size_t i = 0; i < ephemeris.size(); ++i) {
+            std::string name(ephemeris.name(i), strnlen(ephemeris.name(i), sizeof(EphemerisBody::name)));
+            if (name == "planet") ephemeris.attach(i, focus.planet);
+            else if (name == "moon") ephemeris.attach(i, focus.moon);
+            else std::cerr << "Ephemeris body \"" << name << "\" is not in the scene, ignoring it" << std::endl;
+        }
+    }
+    updateBodies(bodies, 0.0, &ephemeris);
+
+    // Ocean glint and night lights for the planet, packed into one compressed texture
+    if (bodyProgram) {
+        bodies.materialTexture[focus.planet] = uploadMaterialTexture(material);
+    }
+
+    // Rings from rings_system.jpg, sampled radially across the annulus
+    if (bodyProgram) {
+        bodies.setRings(focus.planet, RING_INNER_RADIUS, RING_OUTER_RADIUS, uploadTexture(images[3], imageFiles[3]));
+        initRings(RING_INNER_RADIUS, RING_OUTER_RADIUS);
+    }
+
+    // Background stars, if the catalog is present
+    if (bodyProgram) {
+        initStarField(STAR_CATALOG_FILE);
+    }
+
+    // Optional small body field, drawn entirely on the GPU
+    if (smallBodyCount > 0) {
+        if (glCaps.gpuDriven && bodyProgram) {
+            initBodyField(generateSmallBodies(smallBodyCount), moonTexture);
+        }
+        else {
+            std::cerr << "Warning: small body field needs OpenGL 4.3 compute and indirect draws, skipping" << std::endl;
+        }
+    }
+
+    // Optional N-body asteroid belt, simulated on the CPU and drawn through the small body field
+    NBodySystem nbody;
+    if (nbodyCount > 0) {
+        if (!glCaps.gpuDriven || !bodyProgram) {
+            std::cerr << "Warning: N-body mode draws through the small body field (OpenGL 4.3), skipping" << std::endl;
+        }
+        else if (bodyField.bodyCount > 0) {
+            std::cerr << "Warning: --nbody and --bodies share the small body field, ignoring --nbody" << std::endl;
+        }
+        else {
+            initNBody(nbody, nbodyCount, nbodyTheta);
+            std::vector<SmallBodyOrbit> sizes(nbody.count - 1); // Only the radii are used
+            for (size_t i = 1; i < nbody.count; ++i) sizes[i - 1].bodyRadius = nbody.radius[i];
+            initBodyField(sizes, moonTexture);
+            if (bodyField.bodyCount > 0) {
+                bodyField.cpuPositions = true;
+                publishNBodyPositions(nbody);
+            }
+            else {
+                nbody = NBodySystem();
+            }
+        }
+    }
+
+    bool running = true;
+    SDL_Event event;
+    Uint64 sequence = 0;
+    double simTime = 0.0;
+
+    // Publish an initial snapshot so the render thread has something to draw straight away
+    captureScene(bodies, focus, sceneBuffer.writeBuffer());
+    sceneBuffer.writeBuffer().settings = renderSettings;
+    sceneBuffer.writeBuffer().sequence = ++sequence;
+    sceneBuffer.writeBuffer().publishTicks = SDL_GetPerformanceCounter();
+    sceneBuffer.publish();
+
+    double startupMs = (SDL_GetPerformanceCounter() - startupBegin) * 1000.0 / SDL_GetPerformanceFrequency();
+    std::cout << "Startup: " << startupMs << " ms, shaders " << startupMetrics.shaderMs << " ms ("
+        << startupMetrics.programsCached << " cached, " << startupMetrics.programsCompiled << " compiled"
+        << (glCaps.programBinary ? "" : ", no binary cache support") << ")" << std::endl;
+
+    // The benchmark renders on this thread while it still holds the context, then shuts down
+    if (atmosphereBenchmark) {
+        runAtmosphereBenchmark(window, bodies, focus);
+        running = false;
+    }
+
+    // Hand the GL context over to the render thread
+    SDL_GL_MakeCurrent(window, nullptr);
+    renderThreadRunning = true;
+    std::thread renderThread(renderThreadMain, window, context);
+
+    // Main loop: input and simulation only. Rendering runs concurrently on the render thread,
+    // so a slow GPU frame no longer delays input handling or the simulation. Real time
+    // accumulates and is consumed in fixed steps, so simulated motion is the same at any loop
+    // or display rate. A replay takes the time and input from the log instead, frame by frame.
+    Uint64 frequency = session.replaying() ? session.info().frequency : SDL_GetPerformanceFrequency();
+    double stepSeconds = 1.0 / simulationHz;
+    int maxSteps = std::max(1, (int)(MAX_SIMULATION_CATCH_UP * simulationHz));
+    double accumulator = 0.0;
+    Uint64 lastTicks = SDL_GetPerformanceCounter();
+    Uint64 sessionTicks = 0;
+    double simulationMs = 0.0, worstSimulationMs = 0.0;
+    while (running) {
+        Uint64 now = SDL_GetPerformanceCounter();
+        Uint64 elapsed = std::min(now - lastTicks, (Uint64)0xffffffffu); // Fits a SessionFrame
+        lastTicks = now;
+        if (session.replaying()) {
+            // Only closing the window gets through from live input
+            while (SDL_PollEvent(&event)) {
+                if (event.type == SDL_QUIT) running = false;
+            }
+            if (!running || !session.nextFrame(elapsed)) break;
+            for (size_t i = 0; i < session.eventCount(); ++i) {
+                SDL_Event recorded = session.event(i);
+                handleInput(recorded, running, focus);
+            }
+        }
+        else {
+            while (SDL_PollEvent(&event)) {
+                handleInput(event, running, focus);
+                if (session.recording()) session.addEvent(event);
+            }
+        }
+        sessionTicks += elapsed;
+        sessionMilliseconds = (Uint32)(sessionTicks * 1000 / frequency);
+        accumulator += (double)elapsed / frequency;
+        timeWarp.showIn(window);
+
+        // Update celestial bodies. Catch-up after a stall is capped twice over. Backlog beyond
+        // maxSteps is dropped, so the sky slows briefly instead of spiralling; and once the pass
+        // has spent SIMULATION_PASS_BUDGET_MS of wall-clock time, the remaining steps wait for
+        // the next pass, so heavy steps never hold input back for long. A replay runs exactly
+        // the steps the recording did.
+        int steps = 0;
+        int stepLimit = session.replaying() ? session.stepCount() : maxSteps;
+        double nbodyBudgetMs = session.replaying() ? INFINITY : NBODY_FRAME_BUDGET_MS; // Shared by the pass's steps
+        while (accumulator >= stepSeconds && steps < stepLimit) {
+            if (steps > 0 && !session.replaying()
+                && (SDL_GetPerformanceCounter() - now) * 1000.0 / SDL_GetPerformanceFrequency() >= SIMULATION_PASS_BUDGET_MS) break;
+            double warpedStep = stepSeconds * timeWarp.rate;
+            simTime += warpedStep;
+
+            // One step as a small job graph: world positions wait for the orbit offsets, while
+            // spins and the N-body belt run alongside. The tilt recovery is cheap and stays here.
+            JobCounter orbitsDone, stepDone;
+            jobSystem.run([&]() {
+                updateOrbitSystem(bodies, simTime);
+                updateEphemerisSystem(bodies, ephemeris, simTime);
+            }, &orbitsDone);
+            jobSystem.run([&]() { updateTransformSystem(bodies); }, &stepDone, &orbitsDone);
+            jobSystem.run([&]() { updateSpinSystem(bodies, simTime); }, &stepDone);
+            if (nbody.count > 0) {
+                // Once the pass has spent the belt's budget its later steps leave it behind. A
+                // replay repeats the recorded substeps rather than whatever fits the budget here.
+                int substepLimit = session.replaying() ? session.substepLimit(steps) : -1;
+                jobSystem.run([&]() {
+                    Uint64 begin = SDL_GetPerformanceCounter();
+                    advanceNBody(nbody, warpedStep, nbodyBudgetMs, substepLimit);
+                    nbodyBudgetMs -= (SDL_GetPerformanceCounter() - begin) * 1000.0 / SDL_GetPerformanceFrequency();
+                }, &stepDone);
+            }
+            focus.update(stepSeconds);
+            jobSystem.wait(stepDone);
+            if (session.recording() && nbody.count > 0) {
+                session.addSubsteps(nbody.substepsTaken);
+            }
+            if (precisionTest) {
+                focus.zoom = precisionTestZoom(simTime, bodies.radius[focus.planet]); // Overrides the mouse wheel
+            }
+            accumulator -= stepSeconds;
+            ++steps;
+        }
+        if (accumulator >= stepSeconds) {
+            accumulator = steps >= maxSteps ? fmod(accumulator, stepSeconds) : std::min(accumulator, MAX_SIMULATION_CATCH_UP);
+        }
+
+        // Publish an immutable snapshot of the newest step
+        if (steps > 0) {
+            SceneSnapshot& snapshot = sceneBuffer.writeBuffer();
+            captureScene(bodies, focus, snapshot);
+            snapshot.settings = renderSettings;
+            snapshot.sequence = ++sequence;
+            snapshot.simTime = simTime;
+            snapshot.publishTicks = now;
+            sceneBuffer.publish();
+            if (nbody.count > 0) {
+                publishNBodyPositions(nbody);
+            }
+        }
+        if (session.recording()) {
+            session.endFrame((Uint32)elapsed, steps);
+        }
+        double frameMs = (SDL_GetPerformanceCounter() - now) * 1000.0 / SDL_GetPerformanceFrequency();
+        simulationMs += frameMs;
+        worstSimulationMs = std::max(worstSimulationMs, frameMs);
+
+        // Sleep until the next step is due, unless steps are already waiting
+        if (accumulator < stepSeconds) {
+            SDL_Delay((Uint32)((stepSeconds - accumulator) * 1000.0));
+        }
+    }
+
+    // The same session ends in the same state, however fast it was simulated
+    if (session.frames > 0) {
+        char line[200];
+        snprintf(line, sizeof(line), "Session: %llu frames, state fingerprint %016llx, simulation %.3f ms per frame (worst %.3f ms)",
+            (unsigned long long)session.frames, (unsigned long long)sessionFingerprint(bodies, focus, nbody, simTime),
+            simulationMs / session.frames, worstSimulationMs);
+        std::cout << line << std::endl;
+    }
+    session.close();
+
+    // Stop rendering and take the context back for cleanup
+    renderThreadRunning = false;
+    renderThread.join();
+    SDL_GL_MakeCurrent(window, context);
+
+    // Clean up
+    releasePostProcessing();
+    releaseBodyField();
+    releaseStarField();
+    releaseRings();
+    releaseBodyRendering();
+    gpuProfiler.release();
+    IMG_Quit();
+    jobSystem.stop();
+    cleanup(window, context);
+    return 0;
+}
+
+// Render thread: owns the GL context and draws the newest published snapshot each frame.
+// When the simulation hasn't produced anything new it simply redraws the last snapshot.
+void renderThreadMain(SDL_Window* window, SDL_GLContext context) {
+    SDL_GL_MakeCurrent(window, context);
+
+    // Frames are drawn between the two newest snapshots, one step behind the simulation, with
+    // the blend factor taken from real time since the newer one arrived. Motion stays smooth
+    // however the step rate and the display rate relate.
+    SceneSnapshot older, newer;
+    while (renderThreadRunning.load(std::memory_order_acquire)) {
+        if (sceneBuffer.acquire()) {
+            older = newer;
+            newer = sceneBuffer.readBuffer();
+            if (older.sequence == 0) older = newer;
+        }
+        double interval = (double)(newer.publishTicks - older.publishTicks);
+        double blend = interval > 0.0 ? (SDL_GetPerformanceCounter() - newer.publishTicks) / interval : 1.0;
+        renderScene(interpolateSnapshots(older, newer, std::min(blend, 1.0)));
+
+        // Swap buffers (double buffering); vsync paces this thread only
+        SDL_GL_SwapWindow(window);
+    }
+
+    SDL_GL_MakeCurrent(window, nullptr);
+}
+
+// Shortest way round between two angles in degrees
+float lerpDegrees(float from, float to, float t) {
+    float delta = fmodf(to - from + 540.0f, 360.0f) - 180.0f;
+    return from + delta * (float)t;
+}
+
+// Blend a position relative to the body it orbits along the arc rather than the chord: angle
+// and distance in the orbital (XZ) plane, height linearly. Under time warp one step can span
+// a wide arc, and the chord would pull the body inside its orbit between steps.
+void blendAroundParent(double olderX, double olderY, double olderZ, double newerX, double newerY, double newerZ, double t,
+    double& x, double& y, double& z) {
+    double olderAngle = atan2(olderZ, olderX), newerAngle = atan2(newerZ, newerX);
+    double delta = fmod(newerAngle - olderAngle + 3.0 * M_PI, 2.0 * M_PI) - M_PI; // Shortest way round
+    double olderRadius = hypot(olderX, olderZ), newerRadius = hypot(newerX, newerZ);
+    double angle = olderAngle + delta * t, radius = olderRadius + (newerRadius - olderRadius) * t;
+    x = radius * cos(angle);
+    y = olderY + (newerY - olderY) * t;
+    z = radius * sin(angle);
+}
+
+// Render state part way from one simulation step to the next, on the render-time fraction t
+// whatever the simulated span. Positions, angles and the camera are blended; everything else
+// (textures, sizes, settings) comes from the newer step. The camera keeps its blended offset
+// from the planet, so it follows the planet round its arc.
+SceneSnapshot interpolateSnapshots(const SceneSnapshot& older, const SceneSnapshot& newer, double t) {
+    SceneSnapshot frame = newer;
+    frame.simTime = older.simTime + (newer.simTime - older.simTime) * t;
+    blendAroundParent(older.planet.positionX, older.planet.positionY, older.planet.positionZ,
+        newer.planet.positionX, newer.planet.positionY, newer.planet.positionZ, t,
+        frame.planet.positionX, frame.planet.positionY, frame.planet.positionZ);
+    const double planet[3] = { frame.planet.positionX, frame.planet.positionY, frame.planet.positionZ };
+    const double olderPlanet[3] = { older.planet.positionX, older.planet.positionY, older.planet.positionZ };
+    const double newerPlanet[3] = { newer.planet.positionX, newer.planet.positionY, newer.planet.positionZ };
+    for (int i = 0; i < 3; ++i) {
+        double olderEye = older.cameraEye[i] - olderPlanet[i], newerEye = newer.cameraEye[i] - newerPlanet[i];
+        double olderTarget = older.cameraTarget[i] - olderPlanet[i], newerTarget = newer.cameraTarget[i] - newerPlanet[i];
+        frame.cameraEye[i] = planet[i] + olderEye + (newerEye - olderEye) * t;
+        frame.cameraTarget[i] = planet[i] + olderTarget + (newerTarget - olderTarget) * t;
+    }
+    frame.planet.rotationY = lerpDegrees(older.planet.rotationY, newer.planet.rotationY, t);
+    frame.planet.userRotationX = lerpDegrees(older.planet.userRotationX, newer.planet.userRotationX, t);
+    frame.planet.userRotationY = lerpDegrees(older.planet.userRotationY, newer.planet.userRotationY, t);
+    if (older.hasMoon && newer.hasMoon) {
+        blendAroundParent(older.moon.offsetX, older.moon.offsetY, older.moon.offsetZ,
+            newer.moon.offsetX, newer.moon.offsetY, newer.moon.offsetZ, t,
+            frame.moon.offsetX, frame.moon.offsetY, frame.moon.offsetZ);
+        frame.moon.orbitAngle = lerpDegrees(older.moon.orbitAngle, newer.moon.orbitAngle, t);
+    }
+    return frame;
+}
+
+// Draw one snapshot
+void renderScene(const SceneSnapshot& snapshot) {
+    gpuProfiler.beginFrame();
+
+    // Render into the HDR target when available, otherwise straight to the back buffer
+    if (glCaps.postProcessing) {
+        beginHdrScene(snapshot.settings);
+    }
+
+    // Clear the screen and set the background color to black (the depth clear value follows depthMode)
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // Set camera to focus on planet. The view rotation is built around an eye at the origin;
+    // bodies are then placed by their offset from the real eye position.
+    const float up[3] = { 0.0f, 1.0f, 0.0f };
+    const float origin[3] = { 0.0f, 0.0f, 0.0f };
+    float target[3];
+    CameraFrame camera;
+    for (int i = 0; i < 3; ++i) {
+        camera.eye[i] = snapshot.cameraEye[i];
+        target[i] = (float)(snapshot.cameraTarget[i] - snapshot.cameraEye[i]);
+    }
+    camera.rotation = Mat4::lookAt(origin, target, up);
+    Mat4 view = camera.relativeTo(0.0, 0.0, 0.0); // World to view for float world-space data near the sun
+
+    // Set light position at sun's position
+    GLfloat lightPosition[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    glLoadMatrixf(view.m);
+    glLightfv(GL_LIGHT0, GL_POSITION, lightPosition);
+
+    float aspect = (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT;
+    Mat4 unjittered = depthMode == DEPTH_REVERSE_Z ? Mat4::infiniteReversedPerspective(45.0f, aspect, DEPTH_NEAR)
+        : depthMode == DEPTH_LOGARITHMIC ? Mat4::perspective(45.0f, aspect, DEPTH_NEAR, DEPTH_LOG_FAR)
+        : Mat4::perspective(45.0f, aspect, DEPTH_CONVENTIONAL_NEAR, DEPTH_CONVENTIONAL_FAR);
+    float jitterX = 2.0f * temporalAA.jitter[0] / renderWidth, jitterY = 2.0f * temporalAA.jitter[1] / renderHeight;
+    Mat4 projection = temporalAA.active ? unjittered.jittered(jitterX, jitterY) : unjittered;
+    if (bodyProgram) {
+        // Per-frame uniforms go at the start of this frame's ring region
+        frameRing.beginFrame();
+        temporalAA.beginFrame();
+        GLintptr offset = 0;
+        FrameUniforms* frame = (FrameUniforms*)frameRing.allocate(sizeof(FrameUniforms), offset);
+        if (frame) {
+            memcpy(frame->projection, projection.m, sizeof(frame->projection));
+            memcpy(frame->view, view.m, sizeof(frame->view));
+            memcpy(frame->sunPosition, &view.m[12], 3 * sizeof(float)); // The sun sits at the world origin
+            frame->sunPosition[3] = snapshot.sun.radius;
+            memcpy(frame->previousProjection, temporalAA.previousProjection.m, sizeof(frame->previousProjection));
+            frame->jitter[0] = temporalAA.active ? jitterX : 0.0f;
+            frame->jitter[1] = temporalAA.active ? jitterY : 0.0f;
+            frame->jitter[2] = frame->jitter[3] = 0.0f;
+            frameRing.commit(offset, sizeof(FrameUniforms));
+        }
+        glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, frameRing.getBuffer(), offset, sizeof(FrameUniforms));
+        temporalAA.previousProjection = unjittered;
+
+        // Stars first: they sit at infinity behind everything else
+        if (starField.drawCount > 0) {
+            setMotionVectorOutput(false);
+            renderStarField(projection, camera.rotation);
+        }
+        glUseProgram(bodyProgram);
+        setMotionVectorOutput(true);
+    }
+
+    // Render celestial objects
+    ShadowCasters casters = gatherShadowCasters(snapshot, camera);
+    Sun::render(snapshot.sun, camera);
+    if (snapshot.settings.ringDebris && snapshot.planet.ringTextureID && ringSystem.debrisProgram) {
+        setMotionVectorOutput(false);
+        renderRingDebris(snapshot.planet, camera); // Opaque, so before the translucent annulus
+        glUseProgram(bodyProgram);
+        setMotionVectorOutput(true);
+    }
+    Planet::render(snapshot.planet, snapshot.hasMoon ? &snapshot.moon : nullptr, camera, casters);
+    renderAtmospheres(snapshot, camera, projection, casters);
+    Planet::renderRings(snapshot.planet, camera, casters);
+
+    if (bodyProgram) {
+        if (bodyField.bodyCount > 0) {
+            setMotionVectorOutput(false);
+            renderBodyField(snapshot, view, projection);
+        }
+        glUseProgram(0);
+        frameRing.endFrame();
+    }
+
+    // Temporal resolve, then bloom and tone mapping into the back buffer
+    if (glCaps.postProcessing) {
+        resolveTemporalAA();
+        renderBloom(snapshot.settings);
+        compositeToBackBuffer(snapshot.settings);
+    }
+
+    if (snapshot.settings.profilerOverlay) {
+        renderProfilerOverlay();
+    }
+    gpuProfiler.endFrame();
+}
+
+// SDL Initialization
+void initSDL(SDL_Window*& window, SDL_GLContext& context) {
+    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+        std::cerr << "SDL could not initialize! SDL_Error: " << SDL_GetError() << std::endl;
+        exit(1);
+    }
+
+    // Set OpenGL version (using 2.1 for compatibility)
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
+    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+
+    window = SDL_CreateWindow(WINDOW_TITLE,
+        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+        SCREEN_WIDTH, SCREEN_HEIGHT,
+        SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
+    if (!window) {
+        std::cerr << "Window could not be created! SDL_Error: " << SDL_GetError() << std::endl;
+        exit(1);
+    }
+
+    context = SDL_GL_CreateContext(window);
+    if (!context) {
+        std::cerr << "OpenGL context could not be created! SDL_Error: " << SDL_GetError() << std::endl;
+        exit(1);
+    }
+
+    // Enable VSync
+    if (SDL_GL_SetSwapInterval(1) < 0) {
+        std::cerr << "Warning: Unable to set VSync! SDL_Error: " << SDL_GetError() << std::endl;
+    }
+}
+
+// OpenGL Initialization
+void initOpenGL() {
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(45.0, (double)SCREEN_WIDTH / (double)SCREEN_HEIGHT, 1.0, 1000.0); // Increased far clipping plane
+
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_LIGHTING);
+    glEnable(GL_LIGHT0);
+
+    GLfloat lightPosition[] = { 0.0f, 0.0f, 0.0f, 1.0f }; // Light at sun's position
+    glLightfv(GL_LIGHT0, GL_POSITION, lightPosition);
+
+    glShadeModel(GL_SMOOTH);
+    glEnable(GL_TEXTURE_2D);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+// Handle input
+void handleInput(SDL_Event& event, bool& running, SceneFocus& focus) {
+    switch (event.type) {
+    case SDL_QUIT:
+        running = false;
+        break;
+    case SDL_MOUSEMOTION:
+        if (dragging) {
+            int dx = event.motion.x - lastMouseX;
+            int dy = event.motion.y - lastMouseY;
+
+            sphereRotationY += dx * 0.5f;
+            sphereRotationX -= dy * 0.5f;
+
+            // Clamp the X-axis rotation to prevent flipping
+            if (sphereRotationX > 40.0f) sphereRotationX = 40.0f;
+            if (sphereRotationX < -40.0f) sphereRotationX = -40.0f;
+
+            lastMouseX = event.motion.x;
+            lastMouseY = event.motion.y;
+
+            focus.setRotation(sphereRotationX, sphereRotationY);
+            lastInteractionTime = sessionMilliseconds;  // Update the last interaction time
+        }
+        break;
+    case SDL_MOUSEBUTTONDOWN:
+        if (event.button.button == SDL_BUTTON_LEFT) {
+            dragging = true;
+            lastMouseX = event.button.x;
+            lastMouseY = event.button.y;
+        }
+        break;
+    case SDL_MOUSEBUTTONUP:
+        if (event.button.button == SDL_BUTTON_LEFT) {
+            dragging = false;
+        }
+        break;
+    case SDL_MOUSEWHEEL: {
+        float minZoom = depthMode == DEPTH_CONVENTIONAL ? MIN_ZOOM : MIN_ZOOM_PRECISE_DEPTH;
+        if (event.wheel.y > 0) {
+            focus.zoom -= 0.5f; // Zoom in
+        }
+        else if (event.wheel.y < 0) {
+            focus.zoom += 0.5f; // Zoom out
+        }
+        // Only the original 1..1000 projection clips the planet when closer than MIN_ZOOM
+        if (focus.zoom < minZoom) focus.zoom = minZoom;
+        if (focus.zoom > MAX_ZOOM) focus.zoom = MAX_ZOOM;
+        break;
+    }
+    case SDL_KEYDOWN:
+        if (event.key.keysym.sym == SDLK_b) {
+            renderSettings.bloom = !renderSettings.bloom; // Toggle bloom
+        }
+        else if (event.key.keysym.sym == SDLK_h) {
+            renderSettings.bloomHalfResolution = !renderSettings.bloomHalfResolution; // Toggle half-resolution bloom
+        }
+        else if (event.key.keysym.sym == SDLK_r) {
+            renderSettings.dynamicResolution = !renderSettings.dynamicResolution; // Toggle dynamic resolution
+        }
+        else if (event.key.keysym.sym == SDLK_g) {
+            renderSettings.ringDebris = !renderSettings.ringDebris; // Toggle ring debris particles
+        }
+        else if (event.key.keysym.sym == SDLK_t) {
+            renderSettings.temporalAA = !renderSettings.temporalAA; // Toggle temporal anti-aliasing
+        }
+        else if (event.key.keysym.sym == SDLK_u) {
+            renderSettings.temporalUpsampling = !renderSettings.temporalUpsampling; // Toggle temporal upsampling
+        }
+        else if (event.key.keysym.sym == SDLK_a) {
+            // Cycle atmosphere resolution: full, half, quarter
+            renderSettings.atmosphereDownsample = renderSettings.atmosphereDownsample >= ATMOSPHERE_MAX_DOWNSAMPLE ? 1
+                : renderSettings.atmosphereDownsample * 2;
+        }
+        else if (event.key.keysym.sym == SDLK_F1) {
+            renderSettings.profilerOverlay = !renderSettings.profilerOverlay; // Toggle GPU timing overlay
+        }
+        else if (event.key.keysym.sym == SDLK_PERIOD) {
+            timeWarp.faster();
+        }
+        else if (event.key.keysym.sym == SDLK_COMMA) {
+            timeWarp.slower();
+        }
+        else if (event.key.keysym.sym == SDLK_SPACE) {
+            timeWarp.togglePause();
+        }
+        break;
+    }
+}
+
+// Decode an image file, or return null. Touches no GL state, so it is safe on any thread.
+SDL_Surface* decodeImage(const char* filename) {
+    SDL_Surface* surface = IMG_Load(filename);
+    if (!surface) {
+        std::cerr << "Failed to load texture (" << filename << "): " << IMG_GetError() << std::endl;
+    }
+    return surface;
+}
+
+// Upload a decoded image as a texture and free it. Exits if the image failed to decode.
+GLuint uploadTexture(SDL_Surface* surface, const char* filename) {
+    if (!surface) {
+        exit(1);
+    }
+
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+
+    // Set texture parameters
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);    // Horizontal wrapping
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);    // Vertical wrapping
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); // Minification filter
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); // Magnification filter
+
+    // Determine the format
+    GLenum format;
+    if (surface->format->BytesPerPixel == 3) {
+        format = GL_RGB;
+    }
+    else if (surface->format->BytesPerPixel == 4) {
+        format = GL_RGBA;
+    }
+    else {
+        std::cerr << "Unsupported image format for texture: " << filename << std::endl;
+        SDL_FreeSurface(surface);
+        exit(1);
+    }
+
+    // Upload the texture to OpenGL
+    glTexImage2D(GL_TEXTURE_2D, 0, format, surface->w, surface->h, 0, format, GL_UNSIGNED_BYTE, surface->pixels);
+    SDL_FreeSurface(surface);
+    return textureID;
+}
+
+// One channel of an image at (x, y) given in material texels, nearest sample. Images with
+// fewer channels give their last one.
+Uint8 sampleChannel(const SDL_Surface* surface, int x, int y, int width, int height, int channel = 0) {
+    int sx = x * surface->w / width, sy = y * surface->h / height;
+    const Uint8* row = (const Uint8*)surface->pixels + sy * surface->pitch;
+    return row[sx * surface->format->BytesPerPixel + std::min(channel, surface->format->BytesPerPixel - 1)];
+}
+
+// Small integer hash for the placeholder light pattern
+Uint32 hashCell(Uint32 x, Uint32 y) {
+    Uint32 h = x * 0x8da6b343u ^ y * 0xd8163841u;
+    h ^= h >> 13;
+    h *= 0x5bd1e995u;
+    return h ^ (h >> 15);
+}
+
+// Material packing stage: combine single-channel maps into the two channels of one RGTC2
+// texture, which the driver compresses on upload. Red is the ocean mask, green the night
+// lights. A missing ocean mask is derived from the color map (this map paints all water one
+// flat blue); missing night lights get a placeholder of scattered towns on non-ice land.
+// No GL calls, so it can run as a job; uploadMaterialTexture does the rest. The color map is
+// the already decoded planet image, which stays with the caller.
+MaterialImage packMaterialImage(const SDL_Surface* color, const char* oceanFile, const char* lightsFile) {
+    MaterialImage image;
+    if (!color) return image;
+    SDL_Surface* ocean = IMG_Load(oceanFile);
+    SDL_Surface* lights = IMG_Load(lightsFile);
+
+    int width = color->w / MATERIAL_DOWNSAMPLE, height = color->h / MATERIAL_DOWNSAMPLE;
+    std::vector<Uint8>& packed = image.packed;
+    packed.resize((size_t)width * height * 2);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int r = sampleChannel(color, x, y, width, height, 0);
+            int g = sampleChannel(color, x, y, width, height, 1);
+            int b = sampleChannel(color, x, y, width, height, 2);
+
+            Uint8 water;
+            if (ocean) {
+                water = sampleChannel(ocean, x, y, width, height);
+            }
+            else {
+                // Water is strongly blue; pale ice and green/brown land are not
+                int blueness = b - std::max(r, g) - 40;
+                water = (Uint8)std::min(std::max(blueness * 255 / 40, 0), 255);
+            }
+
+            Uint8 light = 0;
+            if (lights) {
+                light = sampleChannel(lights, x, y, width, height);
+            }
+            else if (water < 128 && r + g + b < 600) {
+                // Towns: one in sixteen 16x16 cells, brightest at a random spot inside the cell
+                const int cell = 16;
+                Uint32 h = hashCell(x / cell, y / cell);
+                if ((h & 15) == 0) {
+                    float cx = (float)((h >> 4) & 15), cy = (float)((h >> 8) & 15);
+                    float dx = (x % cell) - cx, dy = (y % cell) - cy;
+                    float falloff = std::max(1.0f - sqrtf(dx * dx + dy * dy) / 6.0f, 0.0f);
+                    float sparkle = (hashCell(x, y) & 255) / 255.0f;
+                    light = (Uint8)(255.0f * falloff * (0.5f + 0.5f * sparkle));
+                }
+            }
+
+            packed[((size_t)y * width + x) * 2] = water;
+            packed[((size_t)y * width + x) * 2 + 1] = light;
+        }
+    }
+    if (ocean) SDL_FreeSurface(ocean);
+    if (lights) SDL_FreeSurface(lights);
+    image.width = width;
+    image.height = height;
+    return image;
+}
+
+// Upload a packed material image as one RGTC2 texture; 0 if packing failed
+GLuint uploadMaterialTexture(const MaterialImage& image) {
+    if (image.packed.empty()) return 0;
+
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Rows of two-byte texels need not be 4-aligned
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RG_RGTC2, image.width, image.height, 0, GL_RG, GL_UNSIGNED_BYTE, image.packed.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    return textureID;
+}
+
+// Cleanup resources
+void cleanup(SDL_Window* window, SDL_GLContext context) {
+    SDL_GL_DeleteContext(context);
     SDL_DestroyWindow(window);
     SDL_Quit();
-}
\ No newline at end of file
+}
+// Load the post-1.1 entry points and work out which rendering paths the context supports
+bool loadGLExtensions() {
+    const char* version = (const char*)glGetString(GL_VERSION);
+    if (version) {
+        glCaps.major = atoi(version);
+        const char* dot = strchr(version, '.');
+        if (dot) glCaps.minor = atoi(dot + 1);
+    }
+
+    bool allLoaded = true;
+#define LOAD_GL_FUNCTION(type, name) \
+    name = (type)SDL_GL_GetProcAddress(#name); \
+    if (!name) allLoaded = false;
+    GL_EXTENSION_FUNCTIONS(LOAD_GL_FUNCTION)
+#undef LOAD_GL_FUNCTION
+#define LOAD_OPTIONAL_GL_FUNCTION(type, name) name = (type)SDL_GL_GetProcAddress(#name);
+    GL_OPTIONAL_EXTENSION_FUNCTIONS(LOAD_OPTIONAL_GL_FUNCTION)
+#undef LOAD_OPTIONAL_GL_FUNCTION
+
+    bool gl33 = glCaps.major > 3 || (glCaps.major == 3 && glCaps.minor >= 3);
+    glCaps.shaders = gl33 && glCreateShader && glCreateProgram;
+    glCaps.framebuffers = gl33 && glGenFramebuffers && glRenderbufferStorage;
+    glCaps.timerQueries = gl33 && glQueryCounter && glGetQueryObjectui64v;
+    glCaps.postProcessing = allLoaded && glCaps.shaders && glCaps.framebuffers;
+    bool gl44 = glCaps.major > 4 || (glCaps.major == 4 && glCaps.minor >= 4);
+    glCaps.bufferStorage = glBufferStorage && (gl44 || SDL_GL_ExtensionSupported("GL_ARB_buffer_storage"));
+    bool gl43 = glCaps.major > 4 || (glCaps.major == 4 && glCaps.minor >= 3);
+    glCaps.gpuDriven = allLoaded && gl43 && glDispatchCompute && glMemoryBarrier && glBindBufferBase && glMultiDrawElementsIndirect
+        && glDrawArraysIndirect && glUniform1d;
+    bool gl45 = glCaps.major > 4 || (glCaps.major == 4 && glCaps.minor >= 5);
+    glCaps.clipControl = glClipControl && (gl45 || SDL_GL_ExtensionSupported("GL_ARB_clip_control"));
+    bool gl41 = glCaps.major > 4 || (glCaps.major == 4 && glCaps.minor >= 1);
+    if (glGetProgramBinary && glProgramBinary && glProgramParameteri && (gl41 || SDL_GL_ExtensionSupported("GL_ARB_get_program_binary"))) {
+        GLint formats = 0; // Drivers may expose the API but offer no format to save in
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        glCaps.programBinary = formats > 0;
+    }
+    return glCaps.postProcessing;
+}
+
+// 64-bit FNV-1a, used to key the program binary cache
+Uint64 hashBytes(const void* data, size_t size, Uint64 hash = 14695981039346656037ull) {
+    const Uint8* bytes = (const Uint8*)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Cache file for a program: its name plus a hash of everything that makes a stored binary
+// invalid, i.e. the driver identity and the final shader text
+std::string programCachePath(const char* name, const std::string* sources, int count) {
+    Uint64 key = hashBytes(name, strlen(name));
+    const GLenum strings[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    for (GLenum id : strings) {
+        const char* value = (const char*)glGetString(id);
+        if (value) key = hashBytes(value, strlen(value), key);
+    }
+    for (int i = 0; i < count; ++i) {
+        key = hashBytes(sources[i].data(), sources[i].size(), key);
+    }
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s-%016llx.bin", PROGRAM_CACHE_DIRECTORY, name, (unsigned long long)key);
+    return path;
+}
+
+// Try to create a program from a cached binary. Returns 0 if there is none or the driver
+// rejects it, in which case the caller compiles from source as usual.
+GLuint loadProgramBinary(const std::string& path) {
+    MappedFile file;
+    if (!file.open(path.c_str())) return 0;
+    const ProgramBinaryHeader* header = (const ProgramBinaryHeader*)file.getData();
+    if (file.getSize() < sizeof(ProgramBinaryHeader) || memcmp(header->magic, PROGRAM_BINARY_MAGIC, sizeof(header->magic)) != 0
+        || file.getSize() < sizeof(ProgramBinaryHeader) + header->length) {
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header->format, header + 1, (GLsizei)header->length);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        glDeleteProgram(program); // Stale after a driver update; recompiling overwrites it
+        return 0;
+    }
+    return program;
+}
+
+void storeProgramBinary(GLuint program, const std::string& path) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+
+    std::vector<char> binary(length);
+    ProgramBinaryHeader header;
+    memcpy(header.magic, PROGRAM_BINARY_MAGIC, sizeof(header.magic));
+    glGetProgramBinary(program, length, nullptr, &header.format, binary.data());
+    header.length = (Uint32)length;
+
+    CreateDirectoryA(PROGRAM_CACHE_DIRECTORY, nullptr); // Fails harmlessly if it already exists
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return; // Caching is best effort
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(binary.data(), 1, binary.size(), file) == binary.size();
+    if (fclose(file) != 0 || !written) {
+        remove(path.c_str()); // A truncated entry would only fail to load next launch
+    }
+}
+
+// Compile and link one program from its stages, or load it from the binary cache when the
+// driver supports it. Returns 0 (and logs why) on failure. Time spent here is reported in the
+// startup metrics.
+GLuint buildProgram(const char* name, const GLenum* stages, const char* const* stageSources, int count) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    std::string sources[2];
+    for (int i = 0; i < count; ++i) {
+        // Splice the global defines in after #version, which has to stay first
+        sources[i] = stageSources[i];
+        size_t lineEnd = sources[i].find('\n', sources[i].find("#version"));
+        if (lineEnd != std::string::npos) sources[i].insert(lineEnd + 1, shaderDefines);
+    }
+
+    std::string cachePath;
+    if (glCaps.programBinary) {
+        cachePath = programCachePath(name, sources, count);
+        GLuint program = loadProgramBinary(cachePath);
+        if (program) {
+            ++startupMetrics.programsCached;
+            startupMetrics.shaderMs += (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+            return program;
+        }
+    }
+
+    GLuint shaders[2] = { 0, 0 };
+    char log[1024];
+    for (int i = 0; i < count; ++i) {
+        const char* text = sources[i].c_str();
+        shaders[i] = glCreateShader(stages[i]);
+        glShaderSource(shaders[i], 1, &text, nullptr);
+        glCompileShader(shaders[i]);
+
+        GLint compiled = GL_FALSE;
+        glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &compiled);
+        if (!compiled) {
+            glGetShaderInfoLog(shaders[i], sizeof(log), nullptr, log);
+            const char* suffix = stages[i] == GL_VERTEX_SHADER ? ".vert" : stages[i] == GL_FRAGMENT_SHADER ? ".frag" : ".comp";
+            std::cerr << "Shader compile failed (" << name << suffix << "): " << log << std::endl;
+            for (int j = 0; j <= i; ++j) glDeleteShader(shaders[j]);
+            return 0;
+        }
+    }
+
+    GLuint program = glCreateProgram();
+    for (int i = 0; i < count; ++i) glAttachShader(program, shaders[i]);
+    if (glCaps.programBinary) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+    for (int i = 0; i < count; ++i) glDeleteShader(shaders[i]); // Flagged for deletion, freed with the program
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+        std::cerr << "Shader link failed (" << name << "): " << log << std::endl;
+        glDeleteProgram(program);
+        return 0;
+    }
+    if (glCaps.programBinary) storeProgramBinary(program, cachePath);
+
+    ++startupMetrics.programsCompiled;
+    startupMetrics.shaderMs += (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+    return program;
+}
+
+// Compile and link a vertex/fragment pair. Returns 0 (and logs why) on failure.
+GLuint createProgram(const char* name, const char* vertexSource, const char* fragmentSource) {
+    const GLenum stages[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    const char* sources[2] = { vertexSource, fragmentSource };
+    return buildProgram(name, stages, sources, 2);
+}
+
+// Shared vertex shader for full-screen passes
+const char* FULLSCREEN_VERTEX_SHADER = R"(
+#version 330 compatibility
+out vec2 uv;
+void main() {
+    uv = gl_MultiTexCoord0.xy;
+    gl_Position = gl_Vertex;
+}
+)";
+
+// Sun, planets, moons and atmosphere shells. Matrices come from the frame and per-draw
+// uniform blocks in the ring buffer rather than the fixed-function stack.
+const char* BODY_VERTEX_SHADER = R"(
+#version 330 compatibility
+layout(std140) uniform FrameUniforms {
+    mat4 projection;
+    mat4 view;
+    vec4 sunPosition;   // View space centre, w: radius
+    mat4 previousProjection;
+    vec4 jitter;        // xy: projection offset in NDC
+};
+layout(std140) uniform BodyUniforms {
+    mat4 modelView;
+    vec4 tint;
+    vec4 material;      // x: emissive intensity (0 = lit), y: occluder count, z: 1 for ring shading,
+                        // w: 1 with a packed surface material
+    vec4 occluders[4];  // View space centre and radius
+    mat4 previousModelView;
+};
+out vec2 uv;
+out vec3 viewPosition;
+out vec3 viewNormal;
+out vec4 currentClip;
+out vec4 previousClip;
+#ifdef LOG_DEPTH_COEFFICIENT
+out float logDepth;
+#endif
+void main() {
+    vec4 position = modelView * gl_Vertex;
+    viewPosition = position.xyz;
+    viewNormal = mat3(modelView) * gl_Normal; // Rigid transforms only, no normal matrix needed
+    uv = gl_MultiTexCoord0.xy;
+    gl_Position = projection * position;
+#ifdef LOG_DEPTH_COEFFICIENT
+    logDepth = 1.0 + gl_Position.w;
+#endif
+    // Motion is measured between unjittered positions so the jitter itself never reads as motion
+    currentClip = vec4(gl_Position.xy - jitter.xy * gl_Position.w, gl_Position.zw);
+    previousClip = previousProjection * (previousModelView * gl_Vertex);
+}
+)";
+
+// Lit bodies match the fixed-function defaults the scene was tuned with: 0.2 global ambient
+// times 0.2 material ambient, plus 0.8 material diffuse from a white light at the sun.
+const char* BODY_FRAGMENT_SHADER = R"(
+#version 330 compatibility
+layout(std140) uniform FrameUniforms {
+    mat4 projection;
+    mat4 view;
+    vec4 sunPosition;
+    mat4 previousProjection;
+    vec4 jitter;
+};
+layout(std140) uniform BodyUniforms {
+    mat4 modelView;
+    vec4 tint;
+    vec4 material;
+    vec4 occluders[4];
+    mat4 previousModelView;
+};
+uniform sampler2D surfaceTexture;
+uniform sampler2D materialTexture;  // r: ocean mask (specular), g: night lights
+in vec2 uv;
+in vec3 viewPosition;
+in vec3 viewNormal;
+in vec4 currentClip;
+in vec4 previousClip;
+#ifdef LOG_DEPTH_COEFFICIENT
+in float logDepth;
+#endif
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec4 velocity;  // Screen motion since last frame in UV units (TAA only)
+
+const float PI = 3.14159265;
+
+// Area shared by two discs of radius r1 and r2 whose centres are d apart
+float discOverlap(float r1, float r2, float d) {
+    if (d >= r1 + r2) return 0.0;
+    if (d <= abs(r1 - r2)) return PI * min(r1, r2) * min(r1, r2);
+    float a1 = r1 * r1 * acos(clamp((d * d + r1 * r1 - r2 * r2) / (2.0 * d * r1), -1.0, 1.0));
+    float a2 = r2 * r2 * acos(clamp((d * d + r2 * r2 - r1 * r1) / (2.0 * d * r2), -1.0, 1.0));
+    float kite = sqrt(max((-d + r1 + r2) * (d + r1 - r2) * (d - r1 + r2) * (d + r1 + r2), 0.0));
+    return a1 + a2 - 0.5 * kite;
+}
+
+// Fraction of the sun's disc visible from a point. Each occluder covers part of the disc in
+// angular terms, which gives the umbra (fully covered) and penumbra (partly covered) directly.
+// Overlapping occluders are subtracted independently, which is fine for a planet and its moon.
+float sunVisibility(vec3 point) {
+    vec3 toSun = sunPosition.xyz - point;
+    float sunDistance = length(toSun);
+    float sunAngle = asin(min(sunPosition.w / sunDistance, 1.0));
+    float visible = 1.0;
+    for (int i = 0; i < int(material.y); ++i) {
+        vec3 toOccluder = occluders[i].xyz - point;
+        float occluderDistance = length(toOccluder);
+        if (occluderDistance >= sunDistance) continue;
+        float occluderAngle = asin(min(occluders[i].w / occluderDistance, 1.0));
+        float separation = atan(length(cross(toSun, toOccluder)), dot(toSun, toOccluder)); // Stable at small angles
+        visible -= discOverlap(sunAngle, occluderAngle, separation) / (PI * sunAngle * sunAngle);
+    }
+    return max(visible, 0.0);
+}
+
+void main() {
+#ifdef LOG_DEPTH_COEFFICIENT
+    gl_FragDepth = log2(logDepth) * LOG_DEPTH_COEFFICIENT;
+#endif
+    vec4 texel = texture(surfaceTexture, uv);
+    vec3 color;
+    if (material.x > 0.0) {
+        color = texel.rgb * material.x;
+    }
+    else if (material.z > 0.0) {
+        // Ring: v runs across the annulus. Opacity follows the profile's brightness and fades
+        // out at both edges. Sunlight reaching the far face has been through the ring, so it
+        // counts for half.
+        vec3 toSun = normalize(sunPosition.xyz - viewPosition);
+        vec3 normal = normalize(viewNormal);
+        float facing = dot(normal, toSun);
+        float diffuse = abs(facing) * (facing * dot(normal, -viewPosition) > 0.0 ? 1.0 : 0.5);
+        diffuse *= sunVisibility(viewPosition);
+        color = texel.rgb * (0.04 + 0.8 * diffuse);
+        float edges = smoothstep(0.0, 0.05, uv.y) * (1.0 - smoothstep(0.95, 1.0, uv.y));
+        texel.a = dot(texel.rgb, vec3(0.299, 0.587, 0.114)) * edges;
+    }
+    else {
+        vec3 toSun = normalize(sunPosition.xyz - viewPosition);
+        vec3 normal = normalize(viewNormal);
+        float facing = dot(normal, toSun);
+        float visibility = facing > 0.0 ? sunVisibility(viewPosition) : 0.0;
+        color = texel.rgb * (0.04 + 0.8 * max(facing, 0.0) * visibility);
+        if (material.w > 0.0) {
+            // One fetch decodes both packed maps: sun glint off water, city lights past the terminator
+            vec2 surface = texture(materialTexture, uv).rg;
+            vec3 halfway = normalize(toSun + normalize(-viewPosition));
+            color += vec3(0.6) * surface.r * pow(max(dot(normal, halfway), 0.0), 60.0) * visibility;
+            color += vec3(1.0, 0.75, 0.4) * surface.g * 0.6 * (1.0 - smoothstep(-0.1, 0.1, facing));
+        }
+    }
+    fragColor = vec4(color, texel.a) * tint;
+
+    // Mostly transparent fragments (ring gaps, thin cloud) leave the motion underneath in place
+    vec2 motion = previousClip.w > 0.0 ? (currentClip.xy / currentClip.w - previousClip.xy / previousClip.w) * 0.5 : vec2(0.0);
+    velocity = vec4(motion, 0.0, fragColor.a >= 0.5 ? 1.0 : 0.0);
+}
+)";
+
+// 13-tap downsample (Jimenez, "Next Generation Post Processing in Call of Duty"). The first
+// pass also applies a soft-knee threshold so only HDR highlights enter the chain.
+const char* BLOOM_DOWNSAMPLE_FRAGMENT_SHADER = R"(
+#version 330 compatibility
+uniform sampler2D sourceTexture;
+uniform vec2 sourceTexelSize;
+uniform float threshold; // <= 0 disables the prefilter
+uniform vec2 sourceUvScale; // Portion of the source holding valid pixels (dynamic resolution)
+in vec2 uv;
+out vec4 fragColor;
+
+vec3 tap(float x, float y) {
+    vec2 coord = uv * sourceUvScale + sourceTexelSize * vec2(x, y);
+    return texture(sourceTexture, min(coord, sourceUvScale - sourceTexelSize * 0.5)).rgb;
+}
+
+void main() {
+    vec3 a = tap(-2.0, 2.0), b = tap(0.0, 2.0), c = tap(2.0, 2.0);
+    vec3 d = tap(-2.0, 0.0), e = tap(0.0, 0.0), f = tap(2.0, 0.0);
+    vec3 g = tap(-2.0, -2.0), h = tap(0.0, -2.0), i = tap(2.0, -2.0);
+    vec3 j = tap(-1.0, 1.0), k = tap(1.0, 1.0), l = tap(-1.0, -1.0), m = tap(1.0, -1.0);
+
+    vec3 color = e * 0.125 + (a + c + g + i) * 0.03125 + (b + d + f + h) * 0.0625 + (j + k + l + m) * 0.125;
+
+    if (threshold > 0.0) {
+        float brightness = max(color.r, max(color.g, color.b));
+        float knee = threshold * 0.5;
+        float soft = clamp(brightness - threshold + knee, 0.0, 2.0 * knee);
+        soft = soft * soft / (4.0 * knee + 1e-4);
+        color *= max(soft, brightness - threshold) / max(brightness, 1e-4);
+    }
+    fragColor = vec4(color, 1.0);
+}
+)";
+
+// 3x3 tent upsample, blended additively into the next larger level
+const char* BLOOM_UPSAMPLE_FRAGMENT_SHADER = R"(
+#version 330 compatibility
+uniform sampler2D sourceTexture;
+uniform vec2 sourceTexelSize;
+in vec2 uv;
+out vec4 fragColor;
+
+vec3 tap(float x, float y) { return texture(sourceTexture, uv + sourceTexelSize * vec2(x, y)).rgb; }
+
+void main() {
+    vec3 color = tap(0.0, 0.0) * 4.0;
+    color += (tap(-1.0, 0.0) + tap(1.0, 0.0) + tap(0.0, -1.0) + tap(0.0, 1.0)) * 2.0;
+    color += tap(-1.0, -1.0) + tap(1.0, -1.0) + tap(-1.0, 1.0) + tap(1.0, 1.0);
+    fragColor = vec4(color / 16.0, 1.0);
+}
+)";
+
+// Adds the bloom back onto the scene and maps HDR radiance into the displayable range
+const char* TONEMAP_FRAGMENT_SHADER = R"(
+#version 330 compatibility
+uniform sampler2D sceneTexture;
+uniform sampler2D bloomTexture;
+uniform float bloomStrength;
+uniform float exposure;
+uniform vec2 sceneUvScale;   // Portion of the scene texture rendered this frame
+uniform vec2 sceneSize;      // Full scene texture size in texels
+in vec2 uv;
+out vec4 fragColor;
+
+// Catmull-Rom upscale from the internal resolution, folded into 9 bilinear taps (MJP's
+// formulation). Taps are clamped to the rendered region so the unused border never bleeds in.
+vec3 sampleCatmullRom(vec2 coord) {
+    vec2 samplePos = coord * sceneSize;
+    vec2 texPos1 = floor(samplePos - 0.5) + 0.5;
+    vec2 f = samplePos - texPos1;
+
+    vec2 w0 = f * (-0.5 + f * (1.0 - 0.5 * f));
+    vec2 w1 = 1.0 + f * f * (-2.5 + 1.5 * f);
+    vec2 w2 = f * (0.5 + f * (2.0 - 1.5 * f));
+    vec2 w3 = f * f * (-0.5 + 0.5 * f);
+    vec2 w12 = w1 + w2;
+
+    vec2 minUv = 0.5 / sceneSize;
+    vec2 maxUv = sceneUvScale - 0.5 / sceneSize;
+    vec2 p0 = clamp((texPos1 - 1.0) / sceneSize, minUv, maxUv);
+    vec2 p12 = clamp((texPos1 + w2 / w12) / sceneSize, minUv, maxUv);
+    vec2 p3 = clamp((texPos1 + 2.0) / sceneSize, minUv, maxUv);
+
+    vec3 result = vec3(0.0);
+    result += texture(sceneTexture, vec2(p0.x, p0.y)).rgb * w0.x * w0.y;
+    result += texture(sceneTexture, vec2(p12.x, p0.y)).rgb * w12.x * w0.y;
+    result += texture(sceneTexture, vec2(p3.x, p0.y)).rgb * w3.x * w0.y;
+    result += texture(sceneTexture, vec2(p0.x, p12.y)).rgb * w0.x * w12.y;
+    result += texture(sceneTexture, vec2(p12.x, p12.y)).rgb * w12.x * w12.y;
+    result += texture(sceneTexture, vec2(p3.x, p12.y)).rgb * w3.x * w12.y;
+    result += texture(sceneTexture, vec2(p0.x, p3.y)).rgb * w0.x * w3.y;
+    result += texture(sceneTexture, vec2(p12.x, p3.y)).rgb * w12.x * w3.y;
+    result += texture(sceneTexture, vec2(p3.x, p3.y)).rgb * w3.x * w3.y;
+    return max(result, vec3(0.0)); // Catmull-Rom can ring negative around the sun's edge
+}
+
+// Narkowicz's fit of the ACES filmic curve
+vec3 tonemapACES(vec3 x) {
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+void main() {
+    vec3 scene = sceneUvScale.x < 1.0 ? sampleCatmullRom(uv * sceneUvScale) : texture(sceneTexture, uv).rgb;
+    vec3 color = scene + texture(bloomTexture, uv).rgb * bloomStrength;
+    fragColor = vec4(tonemapACES(color * exposure), 1.0);
+}
+)";
+
+// Temporal resolve at output resolution. Each output pixel takes the nearest sample of the
+// jittered frame, trusted less the further that sample's true position is from the pixel
+// centre, which is what lets the history fill in detail when the internal resolution is lower.
+// Reprojected history is clamped to the sample's 3x3 neighbourhood, so disoccluded or stale
+// history is rejected without needing depth.
+const char* TAA_RESOLVE_FRAGMENT_SHADER = R"(
+#version 330 compatibility
+uniform sampler2D sceneTexture;     // Jittered frame in its lower-left renderSize texels
+uniform sampler2D velocityTexture;
+uniform sampler2D historyTexture;
+uniform vec2 renderSize;            // Texels rendered this frame
+uniform vec2 jitter;                // This frame's jitter in render texels
+uniform float currentWeight;        // 1 ignores the history
+in vec2 uv;
+out vec4 fragColor;
+
+// Blending in inverse-luminance weights stops HDR highlights like the sun's limb from
+// dominating the average and flickering (Karis, "High Quality Temporal Supersampling")
+float luminanceWeight(vec3 color) {
+    return 1.0 / (1.0 + dot(color, vec3(0.299, 0.587, 0.114)));
+}
+
+void main() {
+    vec2 position = uv * renderSize;
+    ivec2 texel = ivec2(min(floor(position + jitter), renderSize - 1.0));
+    vec2 offset = position - (vec2(texel) + 0.5 - jitter);
+
+    vec3 current = texelFetch(sceneTexture, texel, 0).rgb;
+    vec3 low = current, high = current;
+    for (int y = -1; y <= 1; ++y) {
+        for (int x = -1; x <= 1; ++x) {
+            vec3 color = texelFetch(sceneTexture, clamp(texel + ivec2(x, y), ivec2(0), ivec2(renderSize) - 1), 0).rgb;
+            low = min(low, color);
+            high = max(high, color);
+        }
+    }
+
+    vec2 historyUv = uv - texelFetch(velocityTexture, texel, 0).rg;
+    float blend = currentWeight;
+    if (any(lessThan(historyUv, vec2(0.0))) || any(greaterThan(historyUv, vec2(1.0)))) blend = 1.0;
+    if (blend < 1.0) blend *= exp(-2.29 * dot(offset, offset)); // Gaussian fit of a one-texel footprint
+    vec3 history = clamp(texture(historyTexture, historyUv).rgb, low, high);
+
+    float currentShare = blend * luminanceWeight(current);
+    float historyShare = (1.0 - blend) * luminanceWeight(history);
+    fragColor = vec4((current * currentShare + history * historyShare) / max(currentShare + historyShare, 1e-5), 1.0);
+}
+)";
+
+// Depth-aware (bilateral) upsample of the reduced-resolution atmosphere. Each of the four
+// nearest low-resolution texels is weighted bilinearly and by how closely the scene depth it
+// was rendered against matches this pixel's, so shells stop cleanly at a nearer body's edge
+// instead of bleeding a few low-resolution texels over it.
+const char* ATMOSPHERE_COMPOSITE_FRAGMENT_SHADER = R"(
+#version 330 compatibility
+uniform sampler2D atmosphereTexture;    // Premultiplied radiance and coverage
+uniform sampler2D atmosphereDepth;      // Scene depth at the same reduced resolution
+uniform sampler2D sceneDepth;
+uniform float downsample;
+uniform ivec2 atmosphereSize;           // Texels in use
+uniform vec2 conventionalPlanes;        // Near and far under conventional depth, zero under reverse-Z
+out vec4 fragColor;
+
+const float DEPTH_TOLERANCE = 0.01;     // Relative distance difference that still counts as the same surface
+
+// View distance up to a constant factor; only ratios are compared
+float viewDistance(float depth) {
+#ifdef LOG_DEPTH_COEFFICIENT
+    return exp2(depth / LOG_DEPTH_COEFFICIENT);
+#else
+    if (conventionalPlanes.y > 0.0) {
+        // Window depth from the -1..1 clip range of a near/far perspective
+        float n = conventionalPlanes.x, f = conventionalPlanes.y;
+        return 2.0 * n * f / (f + n - (2.0 * depth - 1.0) * (f - n));
+    }
+    return 1.0 / max(depth, 1e-30);     // Reverse-Z stores near / distance
+#endif
+}
+
+void main() {
+    float distance = viewDistance(texelFetch(sceneDepth, ivec2(gl_FragCoord.xy), 0).r);
+    vec2 position = gl_FragCoord.xy / downsample - 0.5;
+    ivec2 base = ivec2(floor(position));
+    vec2 f = position - vec2(base);
+
+    vec4 sum = vec4(0.0);
+    float total = 0.0;
+    for (int i = 0; i < 4; ++i) {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 texel = clamp(base + offset, ivec2(0), atmosphereSize - 1);
+        float lowDistance = viewDistance(texelFetch(atmosphereDepth, texel, 0).r);
+        float difference = abs(lowDistance - distance) / max(lowDistance, distance);
+        vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+        float weight = bilinear.x * bilinear.y / (DEPTH_TOLERANCE + difference);
+        sum += texelFetch(atmosphereTexture, texel, 0) * weight;
+        total += weight;
+    }
+    fragColor = sum / max(total, 1e-8);
+}
+)";
+
+// Create a render-target texture with linear filtering and clamped edges
+GLuint createTargetTexture(GLint internalFormat, int width, int height, GLenum format, GLenum type) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+    return texture;
+}
+
+// Pick the depth scheme before any program is compiled, since the logarithmic fallback is
+// compiled into the body shaders
+void selectDepthMode() {
+    if (glCaps.clipControl) {
+        depthMode = DEPTH_REVERSE_Z;
+    }
+    else if (glCaps.shaders) {
+        depthMode = DEPTH_LOGARITHMIC;
+        char define[64];
+        snprintf(define, sizeof(define), "#define LOG_DEPTH_COEFFICIENT %.9g\n", 1.0 / log2(DEPTH_LOG_FAR + 1.0));
+        shaderDefines = define;
+    }
+}
+
+// Set the depth state for the chosen mode once the programs exist. Fixed-function rendering
+// keeps the original projection, so any other mode needs the body shader.
+void applyDepthMode() {
+    if (!bodyProgram) {
+        depthMode = DEPTH_CONVENTIONAL;
+        return;
+    }
+    if (depthMode == DEPTH_REVERSE_Z) {
+        glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+        glClearDepth(0.0);
+        glDepthFunc(GL_GREATER);
+    }
+    else {
+        std::cerr << "Warning: no clip control (needs OpenGL 4.5), using logarithmic depth" << std::endl;
+    }
+}
+
+// Body shader and the ring buffer feeding its uniform blocks. Leaves bodyProgram at 0 (fixed
+// function rendering) if either can't be created.
+void initBodyRendering() {
+    bodyProgram = createProgram("body", BODY_VERTEX_SHADER, BODY_FRAGMENT_SHADER);
+    if (!bodyProgram) return;
+
+    glUniformBlockBinding(bodyProgram, glGetUniformBlockIndex(bodyProgram, "FrameUniforms"), FRAME_UNIFORM_BINDING);
+    glUniformBlockBinding(bodyProgram, glGetUniformBlockIndex(bodyProgram, "BodyUniforms"), BODY_UNIFORM_BINDING);
+    glUseProgram(bodyProgram);
+    glUniform1i(glGetUniformLocation(bodyProgram, "surfaceTexture"), 0);
+    glUniform1i(glGetUniformLocation(bodyProgram, "materialTexture"), 1);
+    glUseProgram(0);
+
+    if (!frameRing.init(FRAME_RING_BYTES)) {
+        releaseBodyRendering();
+    }
+}
+
+void releaseBodyRendering() {
+    if (!glDeleteProgram) return;
+    glDeleteProgram(bodyProgram);
+    bodyProgram = 0;
+    frameRing.release();
+}
+
+// Build the HDR target, bloom chain and post-processing programs. Any failure leaves
+// glCaps.postProcessing false so the main loop keeps rendering straight to the back buffer.
+void initPostProcessing() {
+    bloomDownsampleProgram = createProgram("bloom_downsample", FULLSCREEN_VERTEX_SHADER, BLOOM_DOWNSAMPLE_FRAGMENT_SHADER);
+    bloomUpsampleProgram = createProgram("bloom_upsample", FULLSCREEN_VERTEX_SHADER, BLOOM_UPSAMPLE_FRAGMENT_SHADER);
+    tonemapProgram = createProgram("tonemap", FULLSCREEN_VERTEX_SHADER, TONEMAP_FRAGMENT_SHADER);
+    if (!bloomDownsampleProgram || !bloomUpsampleProgram || !tonemapProgram) {
+        releasePostProcessing();
+        return;
+    }
+
+    // Scene target: RGBA16F color plus 32-bit float depth
+    hdrTarget.width = SCREEN_WIDTH;
+    hdrTarget.height = SCREEN_HEIGHT;
+    hdrTarget.colorTexture = createTargetTexture(GL_RGBA16F, hdrTarget.width, hdrTarget.height, GL_RGBA, GL_FLOAT);
+    hdrTarget.depthTexture = createTargetTexture(GL_DEPTH_COMPONENT32F, hdrTarget.width, hdrTarget.height, GL_DEPTH_COMPONENT, GL_FLOAT);
+    glGenFramebuffers(1, &hdrTarget.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, hdrTarget.framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hdrTarget.colorTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, hdrTarget.depthTexture, 0);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+    // Temporal AA: motion vectors as a second scene attachment and two output-resolution
+    // histories. Optional; without it the scene resolves through the Catmull-Rom upscale.
+    temporalAA.program = createProgram("taa_resolve", FULLSCREEN_VERTEX_SHADER, TAA_RESOLVE_FRAGMENT_SHADER);
+    if (temporalAA.program) {
+        glUseProgram(temporalAA.program);
+        glUniform1i(glGetUniformLocation(temporalAA.program, "sceneTexture"), 0);
+        glUniform1i(glGetUniformLocation(temporalAA.program, "velocityTexture"), 1);
+        glUniform1i(glGetUniformLocation(temporalAA.program, "historyTexture"), 2);
+        glUseProgram(0);
+        temporalAA.renderSizeLocation = glGetUniformLocation(temporalAA.program, "renderSize");
+        temporalAA.jitterLocation = glGetUniformLocation(temporalAA.program, "jitter");
+        temporalAA.currentWeightLocation = glGetUniformLocation(temporalAA.program, "currentWeight");
+    }
+    if (temporalAA.program && complete) {
+        temporalAA.velocityTexture = createTargetTexture(GL_RG16F, hdrTarget.width, hdrTarget.height, GL_RG, GL_FLOAT);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, temporalAA.velocityTexture, 0);
+        bool temporalComplete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        for (int i = 0; i < 2; ++i) {
+            temporalAA.historyTextures[i] = createTargetTexture(GL_RGBA16F, hdrTarget.width, hdrTarget.height, GL_RGBA, GL_FLOAT);
+            glGenFramebuffers(1, &temporalAA.historyFramebuffers[i]);
+            glBindFramebuffer(GL_FRAMEBUFFER, temporalAA.historyFramebuffers[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, temporalAA.historyTextures[i], 0);
+            temporalComplete = temporalComplete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        }
+        if (!temporalComplete) {
+            std::cerr << "Warning: temporal AA targets incomplete, rendering without TAA" << std::endl;
+            glBindFramebuffer(GL_FRAMEBUFFER, hdrTarget.framebuffer);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
+            releaseTemporalAA();
+        }
+    }
+
+    // Reduced-resolution atmosphere. Optional; without it the shells draw straight into the scene.
+    atmosphereTarget.program = createProgram("atmosphere_composite", FULLSCREEN_VERTEX_SHADER, ATMOSPHERE_COMPOSITE_FRAGMENT_SHADER);
+    if (atmosphereTarget.program && complete) {
+        atmosphereTarget.width = hdrTarget.width / 2;
+        atmosphereTarget.height = hdrTarget.height / 2;
+        atmosphereTarget.colorTexture = createTargetTexture(GL_RGBA16F, atmosphereTarget.width, atmosphereTarget.height, GL_RGBA, GL_FLOAT);
+        atmosphereTarget.depthTexture = createTargetTexture(GL_DEPTH_COMPONENT32F, atmosphereTarget.width, atmosphereTarget.height,
+            GL_DEPTH_COMPONENT, GL_FLOAT); // Same format as the scene's, as the depth blit requires
+        glGenFramebuffers(1, &atmosphereTarget.framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, atmosphereTarget.framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, atmosphereTarget.colorTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, atmosphereTarget.depthTexture, 0);
+        bool atmosphereComplete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glGenFramebuffers(1, &atmosphereTarget.compositeFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, atmosphereTarget.compositeFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hdrTarget.colorTexture, 0);
+        atmosphereComplete = atmosphereComplete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glGenQueries(1, &atmosphereTarget.fragmentQuery);
+        if (!atmosphereComplete) {
+            std::cerr << "Warning: atmosphere targets incomplete, drawing atmospheres at full resolution" << std::endl;
+            releaseAtmosphereTarget();
+        }
+    }
+
+    // Bloom chain: level 0 is half the screen, each further level halves again. Half-resolution
+    // bloom still downsamples through level 0 but stops its upsample, and the composite, at level 1.
+    int width = SCREEN_WIDTH / 2, height = SCREEN_HEIGHT / 2;
+    for (int i = 0; i < BLOOM_MAX_MIPS && width >= 8 && height >= 8; ++i) {
+        bloomChain.widths[i] = width;
+        bloomChain.heights[i] = height;
+        bloomChain.textures[i] = createTargetTexture(GL_R11F_G11F_B10F, width, height, GL_RGB, GL_FLOAT);
+        glGenFramebuffers(1, &bloomChain.framebuffers[i]);
+        glBindFramebuffer(GL_FRAMEBUFFER, bloomChain.framebuffers[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, bloomChain.textures[i], 0);
+        complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        bloomChain.levelCount = i + 1;
+        width /= 2;
+        height /= 2;
+    }
+    bloomChain.activeLevels = bloomChain.levelCount;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    if (!complete || bloomChain.levelCount < BLOOM_MIN_MIPS) {
+        std::cerr << "Warning: HDR framebuffers incomplete, rendering without bloom" << std::endl;
+        releasePostProcessing();
+    }
+}
+
+void releasePostProcessing() {
+    glCaps.postProcessing = false;
+    if (!glDeleteProgram) return; // Extensions never loaded, nothing was created
+
+    glDeleteProgram(bloomDownsampleProgram);
+    glDeleteProgram(bloomUpsampleProgram);
+    glDeleteProgram(tonemapProgram);
+    bloomDownsampleProgram = bloomUpsampleProgram = tonemapProgram = 0;
+
+    glDeleteFramebuffers(1, &hdrTarget.framebuffer);
+    glDeleteTextures(1, &hdrTarget.depthTexture);
+    glDeleteTextures(1, &hdrTarget.colorTexture);
+    hdrTarget = HdrTarget();
+
+    glDeleteFramebuffers(BLOOM_MAX_MIPS, bloomChain.framebuffers);
+    glDeleteTextures(BLOOM_MAX_MIPS, bloomChain.textures);
+    bloomChain = BloomChain();
+
+    releaseTemporalAA();
+    releaseAtmosphereTarget();
+}
+
+void releaseAtmosphereTarget() {
+    glDeleteProgram(atmosphereTarget.program);
+    glDeleteFramebuffers(1, &atmosphereTarget.framebuffer);
+    glDeleteFramebuffers(1, &atmosphereTarget.compositeFramebuffer);
+    glDeleteTextures(1, &atmosphereTarget.colorTexture);
+    glDeleteTextures(1, &atmosphereTarget.depthTexture);
+    if (atmosphereTarget.fragmentQuery) glDeleteQueries(1, &atmosphereTarget.fragmentQuery);
+    atmosphereTarget = AtmosphereTarget();
+}
+
+void releaseTemporalAA() {
+    glDeleteProgram(temporalAA.program);
+    glDeleteTextures(1, &temporalAA.velocityTexture);
+    glDeleteFramebuffers(2, temporalAA.historyFramebuffers);
+    glDeleteTextures(2, temporalAA.historyTextures);
+    temporalAA = TemporalAA();
+}
+
+// Route scene rendering into the floating-point target at this frame's internal resolution.
+// The target keeps its full size; lower scales just render into its lower-left corner.
+void beginHdrScene(const RenderSettings& settings) {
+    dynamicResolution.update(gpuProfiler.getFrameMs(), settings.dynamicResolution);
+
+    // TAA needs the body shader for motion vectors. The history is stale once it has been off.
+    bool wasActive = temporalAA.active;
+    temporalAA.active = settings.temporalAA && temporalAA.program && bodyProgram;
+    if (!temporalAA.active || !wasActive) temporalAA.historyValid = false;
+
+    float scale = dynamicResolution.getScale();
+    if (temporalAA.active && settings.temporalUpsampling) scale = std::min(scale, TAA_UPSAMPLE_SCALE);
+    renderWidth = std::max(1, (int)(hdrTarget.width * scale + 0.5f));
+    renderHeight = std::max(1, (int)(hdrTarget.height * scale + 0.5f));
+
+    // Halton (2, 3) sub-texel offsets, in [-0.5, 0.5) render texels
+    if (temporalAA.active) {
+        Uint32 phase = temporalAA.frameIndex++ % TAA_JITTER_PHASES + 1;
+        for (int axis = 0; axis < 2; ++axis) {
+            Uint32 base = axis == 0 ? 2 : 3, index = phase;
+            float fraction = 1.0f, value = 0.0f;
+            while (index > 0) {
+                fraction /= base;
+                value += fraction * (index % base);
+                index /= base;
+            }
+            temporalAA.jitter[axis] = value - 0.5f;
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, hdrTarget.framebuffer);
+    glViewport(0, 0, renderWidth, renderHeight);
+    setMotionVectorOutput(true); // Also makes the scene clear reset the motion to zero
+}
+
+// Route the body shader's motion output to the velocity attachment. Other programs have no
+// such output, so the attachment is masked off while they draw.
+void setMotionVectorOutput(bool enabled) {
+    static const GLenum buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    if (!glCaps.postProcessing) return;
+    glDrawBuffers(temporalAA.active && enabled ? 2 : 1, buffers);
+}
+
+// Accumulate this frame into the history. Bloom and tone mapping then read the history,
+// already at output resolution, in place of the HDR target.
+void resolveTemporalAA() {
+    if (!temporalAA.active) return;
+    setMotionVectorOutput(false);
+
+    gpuProfiler.begin(GPU_PASS_TAA);
+    int previous = temporalAA.current;
+    temporalAA.current = 1 - previous;
+    glBindFramebuffer(GL_FRAMEBUFFER, temporalAA.historyFramebuffers[temporalAA.current]);
+    glViewport(0, 0, hdrTarget.width, hdrTarget.height);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_BLEND);
+
+    glUseProgram(temporalAA.program);
+    glUniform2f(temporalAA.renderSizeLocation, (float)renderWidth, (float)renderHeight);
+    glUniform2f(temporalAA.jitterLocation, temporalAA.jitter[0], temporalAA.jitter[1]);
+    glUniform1f(temporalAA.currentWeightLocation, temporalAA.historyValid ? TAA_CURRENT_WEIGHT : 1.0f);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, temporalAA.historyTextures[previous]);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, temporalAA.velocityTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, hdrTarget.colorTexture);
+    drawFullscreenQuad();
+    glUseProgram(0);
+    temporalAA.historyValid = true;
+    gpuProfiler.end(GPU_PASS_TAA);
+
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_LIGHTING);
+    glEnable(GL_BLEND);
+}
+
+// The scene as the post chain reads it: the TAA history at full resolution, or else the
+// rendered corner of the HDR target
+GLuint resolvedSceneTexture(float uvScale[2]) {
+    if (temporalAA.active) {
+        uvScale[0] = uvScale[1] = 1.0f;
+        return temporalAA.historyTextures[temporalAA.current];
+    }
+    uvScale[0] = (float)renderWidth / hdrTarget.width;
+    uvScale[1] = (float)renderHeight / hdrTarget.height;
+    return hdrTarget.colorTexture;
+}
+
+// Pixel rectangle (x0, y0, x1, y1) at render resolution covering a view-space sphere, or the
+// whole target once the sphere reaches the near plane
+void sphereScreenBounds(const float center[3], float radius, const Mat4& projection, int bounds[4]) {
+    float nearest = -center[2] - radius, farthest = -center[2] + radius;
+    if (nearest <= DEPTH_NEAR) {
+        bounds[0] = bounds[1] = 0;
+        bounds[2] = renderWidth;
+        bounds[3] = renderHeight;
+        return;
+    }
+    int sizes[2] = { renderWidth, renderHeight };
+    for (int axis = 0; axis < 2; ++axis) {
+        // The sphere's box extent over its nearest or farthest depth bounds x / -z (or y / -z)
+        float low = center[axis] - radius, high = center[axis] + radius;
+        float minSlope = low / (low >= 0.0f ? farthest : nearest);
+        float maxSlope = high / (high >= 0.0f ? nearest : farthest);
+        float scale = projection.m[axis * 5] * 0.5f * sizes[axis];
+        bounds[axis] = (int)floorf(minSlope * scale + 0.5f * sizes[axis]) - 2; // Slack for the TAA jitter
+        bounds[axis + 2] = (int)ceilf(maxSlope * scale + 0.5f * sizes[axis]) + 2;
+    }
+}
+
+// Atmosphere shells, after every opaque body and before the rings. At full resolution they
+// draw straight into the scene. Otherwise they go to the reduced buffer, and only the screen
+// rectangle the shells can cover is composited, so the fill saved approaches the factor squared.
+void renderAtmospheres(const SceneSnapshot& snapshot, const CameraFrame& camera, const Mat4& projection, const ShadowCasters& casters) {
+    const MoonState* moon = snapshot.hasMoon ? &snapshot.moon : nullptr;
+    int downsample = std::min(snapshot.settings.atmosphereDownsample, ATMOSPHERE_MAX_DOWNSAMPLE);
+    bool counting = atmosphereTarget.countFragments && atmosphereTarget.fragmentQuery;
+
+    gpuProfiler.begin(GPU_PASS_ATMOSPHERE);
+    if (counting) glBeginQuery(GL_SAMPLES_PASSED, atmosphereTarget.fragmentQuery);
+
+    if (downsample <= 1 || !atmosphereTarget.program || !bodyProgram) {
+        Planet::renderAtmospheres(snapshot.planet, moon, camera, casters);
+    }
+    else {
+        Mat4 planetModelView = Planet::modelView(snapshot.planet, camera);
+        int bounds[4], shell[4];
+        sphereScreenBounds(&planetModelView.m[12], snapshot.planet.atmosphereRadius, projection, bounds);
+        if (moon) {
+            Mat4 moonModelView = Moon::modelView(*moon, snapshot.planet, camera);
+            sphereScreenBounds(&moonModelView.m[12], moon->size + 0.05f, projection, shell);
+            for (int i = 0; i < 2; ++i) {
+                bounds[i] = std::min(bounds[i], shell[i]);
+                bounds[i + 2] = std::max(bounds[i + 2], shell[i + 2]);
+            }
+        }
+        bounds[0] = std::max(bounds[0], 0);
+        bounds[1] = std::max(bounds[1], 0);
+        bounds[2] = std::min(bounds[2], renderWidth);
+        bounds[3] = std::min(bounds[3], renderHeight);
+
+        int width = std::max(1, renderWidth / downsample), height = std::max(1, renderHeight / downsample);
+        if (bounds[2] > bounds[0] && bounds[3] > bounds[1]) {
+            // Scene depth down to the reduced buffer, then the shells against it. Premultiplied
+            // color with coverage in alpha makes the composite a single "over".
+            int lowX = bounds[0] / downsample, lowY = bounds[1] / downsample;
+            glEnable(GL_SCISSOR_TEST);
+            glScissor(lowX, lowY, bounds[2] / downsample + 2 - lowX, bounds[3] / downsample + 2 - lowY);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, hdrTarget.framebuffer);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, atmosphereTarget.framebuffer);
+            glBlitFramebuffer(0, 0, width * downsample, height * downsample, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_FRAMEBUFFER, atmosphereTarget.framebuffer);
+            glViewport(0, 0, width, height);
+            glClear(GL_COLOR_BUFFER_BIT);
+            glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+            Planet::renderAtmospheres(snapshot.planet, moon, camera, casters);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, atmosphereTarget.compositeFramebuffer);
+            glViewport(0, 0, renderWidth, renderHeight);
+            glScissor(bounds[0], bounds[1], bounds[2] - bounds[0], bounds[3] - bounds[1]);
+            glDisable(GL_DEPTH_TEST);
+            glDisable(GL_LIGHTING);
+            glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+            glUseProgram(atmosphereTarget.program);
+            glUniform1i(glGetUniformLocation(atmosphereTarget.program, "atmosphereTexture"), 0);
+            glUniform1i(glGetUniformLocation(atmosphereTarget.program, "atmosphereDepth"), 1);
+            glUniform1i(glGetUniformLocation(atmosphereTarget.program, "sceneDepth"), 2);
+            glUniform1f(glGetUniformLocation(atmosphereTarget.program, "downsample"), (float)downsample);
+            glUniform2i(glGetUniformLocation(atmosphereTarget.program, "atmosphereSize"), width, height);
+            bool conventional = depthMode == DEPTH_CONVENTIONAL;
+            glUniform2f(glGetUniformLocation(atmosphereTarget.program, "conventionalPlanes"),
+                conventional ? DEPTH_CONVENTIONAL_NEAR : 0.0f, conventional ? DEPTH_CONVENTIONAL_FAR : 0.0f);
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, hdrTarget.depthTexture);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, atmosphereTarget.depthTexture);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, atmosphereTarget.colorTexture);
+            drawFullscreenQuad();
+
+            // Restore the state the scene pass expects
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            glEnable(GL_DEPTH_TEST);
+            glEnable(GL_LIGHTING);
+            glDisable(GL_SCISSOR_TEST);
+            glBindFramebuffer(GL_FRAMEBUFFER, hdrTarget.framebuffer);
+            setMotionVectorOutput(true);
+            glUseProgram(bodyProgram);
+        }
+    }
+
+    if (counting) {
+        glEndQuery(GL_SAMPLES_PASSED);
+        glGetQueryObjectui64v(atmosphereTarget.fragmentQuery, GL_QUERY_RESULT, &atmosphereTarget.fragments); // Stalls; benchmark only
+    }
+    gpuProfiler.end(GPU_PASS_ATMOSPHERE);
+}
+
+// --atmosphere-benchmark: fragments shaded and GPU time for the atmosphere pass at each
+// resolution factor, over a sweep of zoom levels. Fragments include the composite, so the
+// savings are net. Runs on the main thread before the render thread starts.
+void runAtmosphereBenchmark(SDL_Window* window, const BodyStore& bodies, SceneFocus& focus) {
+    if (!atmosphereTarget.program || !bodyProgram) {
+        std::cerr << "Atmosphere benchmark needs the reduced-resolution atmosphere pass (OpenGL 3.3)" << std::endl;
+        return;
+    }
+    RenderSettings settings = renderSettings;
+    settings.dynamicResolution = false; // Fixed pixel count, so the factors compare directly
+    settings.temporalUpsampling = false;
+    settings.profilerOverlay = false;
+    float minZoom = depthMode == DEPTH_CONVENTIONAL ? MIN_ZOOM : MIN_ZOOM_PRECISE_DEPTH;
+    float savedZoom = focus.zoom;
+    atmosphereTarget.countFragments = true;
+
+    std::cout << " zoom  factor   fragments   saved  atmosphere ms" << std::endl;
+    for (float zoom : ATMOSPHERE_BENCHMARK_ZOOMS) {
+        if (zoom < minZoom) continue;
+        focus.zoom = zoom;
+        GLuint64 fullResolution = 0;
+        for (int downsample = 1; downsample <= ATMOSPHERE_MAX_DOWNSAMPLE; downsample *= 2) {
+            SceneSnapshot snapshot;
+            captureScene(bodies, focus, snapshot);
+            snapshot.settings = settings;
+            snapshot.settings.atmosphereDownsample = downsample;
+            for (int frame = 0; frame < ATMOSPHERE_BENCHMARK_FRAMES; ++frame) {
+                SDL_PumpEvents(); // Keep the window responsive
+                renderScene(snapshot);
+                SDL_GL_SwapWindow(window);
+            }
+
+            if (downsample == 1) fullResolution = atmosphereTarget.fragments;
+            float saved = fullResolution ? 100.0f * (1.0f - (float)atmosphereTarget.fragments / fullResolution) : 0.0f;
+            char line[96];
+            snprintf(line, sizeof(line), "%5.1f  %6d  %10llu  %5.1f%%  %13.3f", zoom, downsample,
+                (unsigned long long)atmosphereTarget.fragments, saved, gpuProfiler.getPassAverageMs(GPU_PASS_ATMOSPHERE));
+            std::cout << line << std::endl;
+        }
+    }
+
+    atmosphereTarget.countFragments = false;
+    focus.zoom = savedZoom;
+}
+
+// --kepler-benchmark: propagate a large batch of random orbits to random times and report the
+// time per batch and the worst position error against a scalar Newton solve. Needs no window.
+int runKeplerBenchmark() {
+    std::mt19937 random(42);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::vector<OrbitalElements> elements(KEPLER_BENCHMARK_ORBITS);
+    OrbitBatch batch;
+    for (OrbitalElements& orbit : elements) {
+        orbit.semiMajorAxis = 1.0 + 100.0 * unit(random);
+        orbit.eccentricity = 0.95 * unit(random);
+        orbit.inclination = M_PI * unit(random);
+        orbit.ascendingNode = 2.0 * M_PI * unit(random);
+        orbit.argumentOfPeriapsis = 2.0 * M_PI * unit(random);
+        orbit.meanAnomalyAtEpoch = 2.0 * M_PI * unit(random);
+        orbit.epoch = 1000.0 * unit(random);
+        orbit.meanMotion = 0.001 + unit(random);
+        batch.add(orbit);
+    }
+
+    size_t padded = (batch.size() + 1) & ~(size_t)1;
+    std::vector<double> x(padded), y(padded), z(padded);
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 total = 0, fastest = ~(Uint64)0;
+    double time = 0.0;
+    for (int run = 0; run < KEPLER_BENCHMARK_RUNS; ++run) {
+        time = 1.0e6 * unit(random);
+        Uint64 start = SDL_GetPerformanceCounter();
+        batch.propagate(time, x.data(), y.data(), z.data());
+        Uint64 elapsed = SDL_GetPerformanceCounter() - start;
+        total += elapsed;
+        fastest = std::min(fastest, elapsed);
+    }
+
+    // Compare orbital radii with a scalar solve iterated to convergence
+    double worstError = 0.0;
+    for (size_t i = 0; i < elements.size(); ++i) {
+        const OrbitalElements& orbit = elements[i];
+        double mean = batch.meanAnomaly(i, time);
+        double anomaly = mean;
+        for (int iteration = 0; iteration < 100; ++iteration) {
+            double step = (anomaly - orbit.eccentricity * sin(anomaly) - mean) / (1.0 - orbit.eccentricity * cos(anomaly));
+            anomaly -= step;
+            if (fabs(step) < 1e-15) break;
+        }
+        double expected = orbit.semiMajorAxis * (1.0 - orbit.eccentricity * cos(anomaly));
+        double actual = sqrt(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+        worstError = std::max(worstError, fabs(actual - expected) / orbit.semiMajorAxis);
+    }
+
+    char line[160];
+    snprintf(line, sizeof(line), "%d orbits, %d Halley iterations: %.1f us average, %.1f us best, worst radius error %.2e of a",
+        KEPLER_BENCHMARK_ORBITS, KEPLER_ITERATIONS, 1.0e6 * total / KEPLER_BENCHMARK_RUNS / frequency,
+        1.0e6 * fastest / frequency, worstError);
+    std::cout << line << std::endl;
+    return 0;
+}
+
+// The old layout, kept only as the baseline for --body-benchmark: every body its own heap
+// object, updated through a virtual call and reaching its parent through a pointer.
+class PolymorphicBody {
+public:
+    double position[3];
+    virtual void update(double time) = 0;
+    virtual ~PolymorphicBody() {}
+};
+
+class PolymorphicOrbiter : public PolymorphicBody {
+protected:
+    OrbitBatch orbit;
+    double offset[4][2];
+    const PolymorphicBody* parent;
+    float spinRate, spinAngle;
+
+public:
+    PolymorphicOrbiter(const OrbitalElements& elements, const PolymorphicBody* p, float spin)
+        : parent(p), spinRate(spin), spinAngle(0.0f)
+    {
+        orbit.add(elements);
+    }
+
+    virtual void update(double time) override {
+        orbit.propagate(time, offset[0], offset[1], offset[2]);
+        spinAngle = (float)fmod(spinRate * time, 360.0);
+        for (int axis = 0; axis < 3; ++axis) {
+            position[axis] = (parent ? parent->position[axis] : 0.0) + offset[axis][0];
+        }
+    }
+};
+
+// --body-benchmark: the same random system of planets and moons updated both ways. Reports
+// the average time per full update and checks the two layouts agree. Needs no window.
+int runBodyBenchmark(int count) {
+    std::mt19937 random(7);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    BodyStore bodies;
+    std::vector<PolymorphicBody*> objects;
+
+    OrbitalElements fixed = {};
+    bodies.create(BODY_SUN, -1, fixed, 10.0f, 0);
+    objects.push_back(new PolymorphicOrbiter(fixed, nullptr, 0.0f));
+    int planet = 0;
+    for (int i = 1; i < count; ++i) {
+        bool isPlanet = (i - 1) % (BODY_BENCHMARK_MOONS + 1) == 0;
+        OrbitalElements orbit = {};
+        orbit.semiMajorAxis = isPlanet ? 20.0 + 1000.0 * unit(random) : 2.0 + 5.0 * unit(random);
+        orbit.eccentricity = 0.2 * unit(random);
+        orbit.inclination = 0.2 * unit(random);
+        orbit.ascendingNode = 2.0 * M_PI * unit(random);
+        orbit.argumentOfPeriapsis = 2.0 * M_PI * unit(random);
+        orbit.meanAnomalyAtEpoch = 2.0 * M_PI * unit(random);
+        orbit.meanMotion = 0.01 + unit(random);
+        float spin = (float)(10.0 * unit(random));
+        int parent = isPlanet ? 0 : planet;
+        int body = bodies.create(isPlanet ? BODY_PLANET : BODY_MOON, parent, orbit, 1.0f, 0);
+        bodies.spinRate[body] = spin;
+        objects.push_back(new PolymorphicOrbiter(orbit, objects[parent], spin));
+        if (isPlanet) planet = body;
+    }
+
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 objectTicks = 0, storeTicks = 0;
+    double time = 0.0;
+    for (int run = 0; run < BODY_BENCHMARK_RUNS; ++run) {
+        time = 1000.0 * unit(random);
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (PolymorphicBody* object : objects) {
+            object->update(time);
+        }
+        Uint64 middle = SDL_GetPerformanceCounter();
+        updateBodies(bodies, time);
+        storeTicks += SDL_GetPerformanceCounter() - middle;
+        objectTicks += middle - start;
+    }
+
+    double worstDifference = 0.0;
+    for (size_t i = 0; i < bodies.count; ++i) {
+        worstDifference = std::max(worstDifference, fabs(bodies.positionX[i] - objects[i]->position[0]));
+        worstDifference = std::max(worstDifference, fabs(bodies.positionY[i] - objects[i]->position[1]));
+        worstDifference = std::max(worstDifference, fabs(bodies.positionZ[i] - objects[i]->position[2]));
+    }
+    for (PolymorphicBody* object : objects) {
+        delete object;
+    }
+
+    double objectMs = 1000.0 * objectTicks / BODY_BENCHMARK_RUNS / frequency;
+    double storeMs = 1000.0 * storeTicks / BODY_BENCHMARK_RUNS / frequency;
+    char line[160];
+    snprintf(line, sizeof(line), "%d bodies: objects %.3f ms, component store %.3f ms (%.1fx), largest difference %.1e",
+        count, objectMs, storeMs, storeMs > 0.0 ? objectMs / storeMs : 0.0, worstDifference);
+    std::cout << line << std::endl;
+    return 0;
+}
+
+// --build-ephemeris: fit the scene's planet and moon orbits with Chebyshev segments over
+// [0, span], write them as an ephemeris, then map the file back and report its worst position
+// error against the orbits and the cost of a lookup. orbitRadius is the planet's semi-major
+// axis, as the scene uses it. Needs no window.
+int buildEphemeris(const char* path, double span, double orbitRadius) {
+    const char* names[2] = { "planet", "moon" };
+    OrbitalElements elements[2] = { planetOrbitElements(orbitRadius), moonOrbitElements() };
+    const Uint32 degree = EPHEMERIS_BUILD_DEGREE;
+    const Uint32 nodes = degree + 1;
+
+    EphemerisHeader header;
+    memcpy(header.magic, EPHEMERIS_MAGIC, sizeof(header.magic));
+    header.version = EPHEMERIS_VERSION;
+    header.bodyCount = 2;
+    header.bodyRecordSize = sizeof(EphemerisBody);
+
+    EphemerisBody records[2] = {};
+    std::vector<double> coefficients[2];
+    Uint64 offset = sizeof(header) + sizeof(records);
+    for (int body = 0; body < 2; ++body) {
+        EphemerisBody& record = records[body];
+        strncpy(record.name, names[body], sizeof(record.name));
+        record.startTime = 0.0;
+        record.segmentLength = 2.0 * M_PI / elements[body].meanMotion / EPHEMERIS_BUILD_SEGMENTS_PER_ORBIT;
+        record.segmentCount = (Uint32)ceil(span / record.segmentLength);
+        record.degree = degree;
+        record.offset = offset;
+        offset += (Uint64)record.segmentCount * 3 * nodes * sizeof(double);
+
+        // Sample at the Chebyshev nodes of each segment; the discrete cosine sums then give
+        // the interpolating polynomial's coefficients
+        OrbitBatch orbit;
+        orbit.add(elements[body]);
+        coefficients[body].resize((size_t)record.segmentCount * 3 * nodes);
+        std::vector<double> samples(3 * nodes);
+        for (Uint32 segment = 0; segment < record.segmentCount; ++segment) {
+            for (Uint32 j = 0; j < nodes; ++j) {
+                double node = cos(M_PI * (j + 0.5) / nodes);
+                double time = (segment + 0.5 * (node + 1.0)) * record.segmentLength;
+                double position[3][2];
+                orbit.propagate(time, position[0], position[1], position[2]);
+                for (int axis = 0; axis < 3; ++axis) samples[axis * nodes + j] = position[axis][0];
+            }
+            double* c = &coefficients[body][(size_t)segment * 3 * nodes];
+            for (int axis = 0; axis < 3; ++axis) {
+                for (Uint32 k = 0; k < nodes; ++k) {
+                    double sum = 0.0;
+                    for (Uint32 j = 0; j < nodes; ++j) sum += samples[axis * nodes + j] * cos(M_PI * k * (j + 0.5) / nodes);
+                    c[axis * nodes + k] = (k == 0 ? 1.0 : 2.0) * sum / nodes;
+                }
+            }
+        }
+    }
+
+    FILE* output = fopen(path, "wb");
+    bool written = output
+        && fwrite(&header, sizeof(header), 1, output) == 1
+        && fwrite(records, sizeof(records), 1, output) == 1
+        && fwrite(coefficients[0].data(), sizeof(double), coefficients[0].size(), output) == coefficients[0].size()
+        && fwrite(coefficients[1].data(), sizeof(double), coefficients[1].size(), output) == coefficients[1].size();
+    if (output) written = fclose(output) == 0 && written;
+    if (!written) {
+        std::cerr << "Could not write ephemeris " << path << std::endl;
+        return 1;
+    }
+
+    Ephemeris ephemeris;
+    if (!ephemeris.open(path)) return 1;
+
+    // Worst error at random times, and the time per lookup as a frame loop would make them:
+    // time moving forward, so the cached segments are mostly reused
+    std::mt19937 random(11);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    OrbitBatch orbits;
+    orbits.add(elements[0]);
+    orbits.add(elements[1]);
+    double expected[3][2], actual[3][2];
+    double worstError = 0.0;
+    for (int sample = 0; sample < EPHEMERIS_CHECK_SAMPLES; ++sample) {
+        double time = span * unit(random);
+        orbits.propagate(time, expected[0], expected[1], expected[2]);
+        ephemeris.evaluate(time, actual[0], actual[1], actual[2]);
+        for (int body = 0; body < 2; ++body) {
+            double dx = actual[0][body] - expected[0][body], dy = actual[1][body] - expected[1][body], dz = actual[2][body] - expected[2][body];
+            worstError = std::max(worstError, sqrt(dx * dx + dy * dy + dz * dz));
+        }
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    double checksum = 0.0;
+    for (int sample = 0; sample < EPHEMERIS_CHECK_SAMPLES; ++sample) {
+        ephemeris.evaluate(span * sample / EPHEMERIS_CHECK_SAMPLES, actual[0], actual[1], actual[2]);
+        checksum += actual[0][0] + actual[2][1];
+    }
+    double lookupNs = 1.0e9 * (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency() / EPHEMERIS_CHECK_SAMPLES / 2;
+
+    char line[240];
+    snprintf(line, sizeof(line), "Wrote %s: 2 bodies over %.0f s, degree %u, %.1f KB; worst error %.2e units, %.1f ns per body lookup (checksum %.3g)",
+        path, span, degree, offset / 1024.0, worstError, lookupNs, checksum);
+    std::cout << line << std::endl;
+    return 0;
+}
+
+// Full-screen quad in clip space; the fixed matrices are left untouched for the scene
+void drawFullscreenQuad() {
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.0f, 0.0f); glVertex2f(-1.0f, -1.0f);
+    glTexCoord2f(1.0f, 0.0f); glVertex2f(1.0f, -1.0f);
+    glTexCoord2f(1.0f, 1.0f); glVertex2f(1.0f, 1.0f);
+    glTexCoord2f(0.0f, 1.0f); glVertex2f(-1.0f, 1.0f);
+    glEnd();
+}
+
+// Progressive downsample of the HDR scene followed by an additive upsample back up the chain
+void renderBloom(const RenderSettings& settings) {
+    if (!settings.bloom) return;
+
+    // Keep the chain inside its GPU budget by trimming levels from the small end when over it,
+    // and restore them one at a time once there is plenty of headroom again.
+    static int framesSinceAdjust = 0;
+    int firstLevel = settings.bloomHalfResolution ? 1 : 0;
+    if (++framesSinceAdjust >= 30 && gpuProfiler.getPassAverageMs(GPU_PASS_BLOOM) > 0.0f) {
+        float cost = gpuProfiler.getPassAverageMs(GPU_PASS_BLOOM);
+        if (cost > BLOOM_GPU_BUDGET_MS && bloomChain.activeLevels > BLOOM_MIN_MIPS) {
+            --bloomChain.activeLevels;
+            framesSinceAdjust = 0;
+        }
+        else if (cost < BLOOM_GPU_BUDGET_MS * 0.5f && bloomChain.activeLevels < bloomChain.levelCount) {
+            ++bloomChain.activeLevels;
+            framesSinceAdjust = 0;
+        }
+    }
+    int lastLevel = std::min(firstLevel + bloomChain.activeLevels, bloomChain.levelCount) - 1;
+
+    gpuProfiler.begin(GPU_PASS_BLOOM);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_BLEND);
+    glActiveTexture(GL_TEXTURE0);
+
+    // Downsample: scene -> level 0 (with threshold) -> ... -> lastLevel. Half-resolution bloom
+    // starts here too, since a single tap straight to quarter size aliases small bright pixels.
+    glUseProgram(bloomDownsampleProgram);
+    glUniform1i(glGetUniformLocation(bloomDownsampleProgram, "sourceTexture"), 0);
+    GLint texelSizeLocation = glGetUniformLocation(bloomDownsampleProgram, "sourceTexelSize");
+    GLint thresholdLocation = glGetUniformLocation(bloomDownsampleProgram, "threshold");
+    GLint uvScaleLocation = glGetUniformLocation(bloomDownsampleProgram, "sourceUvScale");
+    float sceneUvScale[2];
+    GLuint source = resolvedSceneTexture(sceneUvScale);
+    int sourceWidth = hdrTarget.width, sourceHeight = hdrTarget.height;
+    for (int i = 0; i <= lastLevel; ++i) {
+        glBindFramebuffer(GL_FRAMEBUFFER, bloomChain.framebuffers[i]);
+        glViewport(0, 0, bloomChain.widths[i], bloomChain.heights[i]);
+        glBindTexture(GL_TEXTURE_2D, source);
+        glUniform2f(texelSizeLocation, 1.0f / sourceWidth, 1.0f / sourceHeight);
+        glUniform1f(thresholdLocation, i == 0 ? BLOOM_THRESHOLD : 0.0f);
+        if (i == 0) {
+            glUniform2f(uvScaleLocation, sceneUvScale[0], sceneUvScale[1]);
+        }
+        else {
+            glUniform2f(uvScaleLocation, 1.0f, 1.0f);
+        }
+        drawFullscreenQuad();
+        source = bloomChain.textures[i];
+        sourceWidth = bloomChain.widths[i];
+        sourceHeight = bloomChain.heights[i];
+    }
+
+    // Upsample: lastLevel -> ... -> firstLevel, accumulating into each larger level
+    glUseProgram(bloomUpsampleProgram);
+    glUniform1i(glGetUniformLocation(bloomUpsampleProgram, "sourceTexture"), 0);
+    texelSizeLocation = glGetUniformLocation(bloomUpsampleProgram, "sourceTexelSize");
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    for (int i = lastLevel; i > firstLevel; --i) {
+        glBindFramebuffer(GL_FRAMEBUFFER, bloomChain.framebuffers[i - 1]);
+        glViewport(0, 0, bloomChain.widths[i - 1], bloomChain.heights[i - 1]);
+        glBindTexture(GL_TEXTURE_2D, bloomChain.textures[i]);
+        glUniform2f(texelSizeLocation, 1.0f / bloomChain.widths[i], 1.0f / bloomChain.heights[i]);
+        drawFullscreenQuad();
+    }
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    glUseProgram(0);
+    gpuProfiler.end(GPU_PASS_BLOOM);
+}
+
+// Tone map the HDR scene (plus bloom) into the default framebuffer
+void compositeToBackBuffer(const RenderSettings& settings) {
+    int bloomLevel = settings.bloomHalfResolution ? 1 : 0;
+    float sceneUvScale[2];
+    GLuint scene = resolvedSceneTexture(sceneUvScale);
+
+    gpuProfiler.begin(GPU_PASS_TONEMAP);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_BLEND);
+
+    glUseProgram(tonemapProgram);
+    glUniform1i(glGetUniformLocation(tonemapProgram, "sceneTexture"), 0);
+    glUniform1i(glGetUniformLocation(tonemapProgram, "bloomTexture"), 1);
+    glUniform1f(glGetUniformLocation(tonemapProgram, "bloomStrength"), settings.bloom ? BLOOM_STRENGTH : 0.0f);
+    glUniform1f(glGetUniformLocation(tonemapProgram, "exposure"), HDR_EXPOSURE);
+    glUniform2f(glGetUniformLocation(tonemapProgram, "sceneUvScale"), sceneUvScale[0], sceneUvScale[1]);
+    glUniform2f(glGetUniformLocation(tonemapProgram, "sceneSize"), (float)hdrTarget.width, (float)hdrTarget.height);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, bloomChain.textures[bloomLevel]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, scene);
+    drawFullscreenQuad();
+    glUseProgram(0);
+    gpuProfiler.end(GPU_PASS_TONEMAP);
+
+    // Restore the state the scene pass expects
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_LIGHTING);
+    glEnable(GL_BLEND);
+}
+
+// 3x5 pixel font for the overlay: one row of three bits per line, top row first
+unsigned short overlayGlyph(char c) {
+    if (c >= 'a' && c <= 'z') c = c - 'a' + 'A';
+    static const unsigned short digits[10] = {
+        0b111'101'101'101'111, 0b010'110'010'010'111, 0b111'001'111'100'111, 0b111'001'111'001'111,
+        0b101'101'111'001'001, 0b111'100'111'001'111, 0b111'100'111'101'111, 0b111'001'001'001'001,
+        0b111'101'111'101'111, 0b111'101'111'001'111
+    };
+    static const unsigned short letters[26] = {
+        0b010'101'111'101'101, 0b110'101'110'101'110, 0b011'100'100'100'011, 0b110'101'101'101'110, // A-D
+        0b111'100'110'100'111, 0b111'100'110'100'100, 0b011'100'101'101'011, 0b101'101'111'101'101, // E-H
+        0b111'010'010'010'111, 0b001'001'001'101'010, 0b101'101'110'101'101, 0b100'100'100'100'111, // I-L
+        0b101'111'111'101'101, 0b110'101'101'101'101, 0b010'101'101'101'010, 0b110'101'110'100'100, // M-P
+        0b010'101'101'110'011, 0b110'101'110'101'101, 0b011'100'010'001'110, 0b111'010'010'010'010, // Q-T
+        0b101'101'101'101'111, 0b101'101'101'101'010, 0b101'101'111'111'101, 0b101'101'010'101'101, // U-X
+        0b101'101'010'010'010, 0b111'001'010'100'111                                                 // Y-Z
+    };
+    if (c >= '0' && c <= '9') return digits[c - '0'];
+    if (c >= 'A' && c <= 'Z') return letters[c - 'A'];
+    switch (c) {
+    case '.': return 0b000'000'000'000'010;
+    case ':': return 0b000'010'000'010'000;
+    case '-': return 0b000'000'111'000'000;
+    case '%': return 0b101'001'010'100'101;
+    case '/': return 0b001'001'010'100'100;
+    default: return 0;
+    }
+}
+
+// Draw text with its top-left corner at (x, y) in window pixels
+void drawOverlayText(float x, float y, float pixel, const char* text) {
+    glBegin(GL_QUADS);
+    for (; *text; ++text, x += pixel * 4.0f) {
+        unsigned short glyph = overlayGlyph(*text);
+        for (int row = 0; row < 5; ++row) {
+            for (int column = 0; column < 3; ++column) {
+                if (!(glyph & (1 << ((4 - row) * 3 + (2 - column))))) continue;
+                float px = x + column * pixel, py = y + row * pixel;
+                glVertex2f(px, py);
+                glVertex2f(px + pixel, py);
+                glVertex2f(px + pixel, py + pixel);
+                glVertex2f(px, py + pixel);
+            }
+        }
+    }
+    glEnd();
+}
+
+// Live GPU timing readout: one bar per pass (scaled so 1 ms = 100 pixels) with its timing
+void renderProfilerOverlay() {
+    gpuProfiler.begin(GPU_PASS_OVERLAY);
+
+    glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glOrtho(0.0, SCREEN_WIDTH, SCREEN_HEIGHT, 0.0, -1.0, 1.0);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_TEXTURE_2D);
+
+    static const float passColors[GPU_PASS_COUNT][3] = {
+        { 0.9f, 0.9f, 1.0f }, { 1.0f, 0.8f, 0.2f }, { 0.3f, 0.6f, 1.0f }, { 0.7f, 0.9f, 1.0f },
+        { 0.7f, 0.7f, 0.7f }, { 0.9f, 0.8f, 0.6f }, { 0.6f, 0.5f, 0.4f }, { 0.8f, 0.6f, 0.4f },
+        { 0.4f, 0.9f, 0.9f }, { 1.0f, 0.5f, 0.8f }, { 0.5f, 1.0f, 0.5f }, { 0.6f, 0.6f, 0.3f }
+    };
+    const float pixel = 3.0f, lineHeight = 24.0f, pixelsPerMs = 100.0f;
+    float x = 16.0f, y = 16.0f;
+    char line[64];
+
+    // Backdrop so the text stays readable over the sun
+    glColor4f(0.0f, 0.0f, 0.0f, 0.6f);
+    glRectf(x - 8.0f, y - 8.0f, x + 520.0f, y + lineHeight * (GPU_PASS_COUNT + 2));
+
+    glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+    if (!glCaps.timerQueries) {
+        drawOverlayText(x, y, pixel, "GPU TIMERS UNAVAILABLE");
+    }
+    else {
+        snprintf(line, sizeof(line), "GPU FRAME %6.2f MS  RES %3d%%", gpuProfiler.getFrameAverageMs(),
+            (int)(100.0f * renderWidth / SCREEN_WIDTH + 0.5f));
+        drawOverlayText(x, y, pixel, line);
+
+        for (int i = 0; i < GPU_PASS_COUNT; ++i) {
+            GpuPass pass = (GpuPass)i;
+            float ms = gpuProfiler.getPassAverageMs(pass);
+            y += lineHeight;
+
+            glColor4f(passColors[i][0], passColors[i][1], passColors[i][2], 1.0f);
+            glRectf(x + 260.0f, y, x + 260.0f + std::min(ms * pixelsPerMs, 250.0f), y + pixel * 5.0f);
+            snprintf(line, sizeof(line), "%-10s %6.2f MS", GpuProfiler::getPassName(pass), ms);
+            drawOverlayText(x, y, pixel, line);
+        }
+    }
+
+    glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+    glEnable(GL_TEXTURE_2D);
+    glEnable(GL_LIGHTING);
+    glEnable(GL_DEPTH_TEST);
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopMatrix();
+
+    gpuProfiler.end(GPU_PASS_OVERLAY);
+}
+
+// Compile and link a compute shader. Returns 0 (and logs why) on failure.
+GLuint createComputeProgram(const char* name, const char* source) {
+    const GLenum stage = GL_COMPUTE_SHADER;
+    return buildProgram(name, &stage, &source, 1);
+}
+
+// Per-body visibility, LOD selection and indirect command building for the small body field
+const char* BODY_FIELD_CULL_SHADER = R"(
+#version 430
+layout(local_size_x = 64) in;
+
+struct Orbit {
+    vec4 periapsis; // Towards periapsis times the semi-major axis, eccentricity
+    vec4 normal;    // 90 degrees on times the semi-minor axis, mean anomaly at t = 0
+    vec4 motion;    // Mean motion, body radius
+};
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(std430, binding = 0) readonly buffer Orbits { Orbit orbits[]; };
+layout(std430, binding = 1) buffer Bounds { vec4 bounds[]; };
+layout(std430, binding = 2) writeonly buffer Instances { vec4 instances[]; };
+layout(std430, binding = 3) buffer Commands { DrawCommand commands[]; };
+layout(std430, binding = 4) buffer PointCommand { uint pointCount; uint pointInstances; uint pointFirst; uint pointBaseInstance; };
+
+uniform uint bodyCount;
+uniform bool evaluateOrbits;    // False when the CPU has already written this frame's bounds
+uniform double simTime;         // Double, so mean anomalies stay exact under time warp
+uniform vec4 frustumPlanes[6];  // World space, normalized, pointing inwards
+uniform vec3 cameraPosition;
+uniform float projectionScale;  // Pixels per unit of radius at unit distance
+uniform float minPixelRadius;
+uniform float lodPixelRadius[2];
+uniform float pointPixelRadius;
+uniform uint pointBase;         // Start of the point range in the instance buffer
+
+void main() {
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= bodyCount) return;
+
+    vec4 body;
+    if (evaluateOrbits) {
+        // Kepler's equation by Newton's method; three steps from M + e sin M is plenty in
+        // single precision for the belt's low eccentricities
+        Orbit orbit = orbits[index];
+        float e = orbit.periapsis.w;
+        float mean = float(mod(double(orbit.normal.w) + double(orbit.motion.x) * simTime, 6.283185307179586LF));
+        float anomaly = mean + e * sin(mean);
+        for (int i = 0; i < 3; ++i) {
+            anomaly -= (anomaly - e * sin(anomaly) - mean) / (1.0 - e * cos(anomaly));
+        }
+        body = vec4(orbit.periapsis.xyz * (cos(anomaly) - e) + orbit.normal.xyz * sin(anomaly), orbit.motion.y);
+        bounds[index] = body;
+    }
+    else {
+        body = bounds[index];
+    }
+
+    for (int i = 0; i < 6; ++i) {
+        if (dot(frustumPlanes[i].xyz, body.xyz) + frustumPlanes[i].w < -body.w) return;
+    }
+
+    float pixelRadius = body.w * projectionScale / max(distance(body.xyz, cameraPosition), 1e-3);
+    if (pixelRadius < minPixelRadius) return;
+    if (pixelRadius < pointPixelRadius) {
+        instances[pointBase + atomicAdd(pointCount, 1u)] = body;
+        return;
+    }
+
+    uint lod = pixelRadius >= lodPixelRadius[0] ? 0u : (pixelRadius >= lodPixelRadius[1] ? 1u : 2u);
+    uint slot = atomicAdd(commands[lod].instanceCount, 1u);
+    instances[commands[lod].baseInstance + slot] = body;
+}
+)";
+
+const char* BODY_FIELD_VERTEX_SHADER = R"(
+#version 430 compatibility
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec2 texCoord;
+layout(location = 3) in vec4 instance;  // World centre and radius, one per drawn body
+layout(std140) uniform FrameUniforms {
+    mat4 projection;
+    mat4 view;
+    vec4 sunPosition;
+};
+out vec2 uv;
+out vec3 viewPosition;
+out vec3 viewNormal;
+#ifdef LOG_DEPTH_COEFFICIENT
+out float logDepth;
+#endif
+void main() {
+    vec4 worldPosition = vec4(instance.xyz + position * instance.w, 1.0);
+    vec4 eyePosition = view * worldPosition;
+    viewPosition = eyePosition.xyz;
+    viewNormal = mat3(view) * normal;
+    uv = texCoord;
+    gl_Position = projection * eyePosition;
+#ifdef LOG_DEPTH_COEFFICIENT
+    logDepth = 1.0 + gl_Position.w;
+#endif
+}
+)";
+
+const char* BODY_FIELD_FRAGMENT_SHADER = R"(
+#version 430 compatibility
+layout(std140) uniform FrameUniforms {
+    mat4 projection;
+    mat4 view;
+    vec4 sunPosition;
+};
+uniform sampler2D surfaceTexture;
+in vec2 uv;
+in vec3 viewPosition;
+in vec3 viewNormal;
+#ifdef LOG_DEPTH_COEFFICIENT
+in float logDepth;
+#endif
+out vec4 fragColor;
+void main() {
+#ifdef LOG_DEPTH_COEFFICIENT
+    gl_FragDepth = log2(logDepth) * LOG_DEPTH_COEFFICIENT;
+#endif
+    vec3 toSun = normalize(sunPosition.xyz - viewPosition);
+    float diffuse = max(dot(normalize(viewNormal), toSun), 0.0);
+    fragColor = vec4(texture(surfaceTexture, uv).rgb * (0.04 + 0.8 * diffuse), 1.0);
+}
+)";
+
+// Bodies under BODY_FIELD_POINT_PIXEL_RADIUS: one sprite each, at least a pixel across, shaded
+// as a sunlit sphere. Sprites smaller than their pixel keep their brightness by covering less.
+const char* BODY_FIELD_POINT_VERTEX_SHADER = R"(
+#version 430 compatibility
+layout(location = 0) in vec4 instance;  // World centre and radius
+layout(std140) uniform FrameUniforms {
+    mat4 projection;
+    mat4 view;
+    vec4 sunPosition;
+};
+uniform float projectionScale;  // Output pixels per unit of radius at unit distance
+uniform float sizeScale;        // Internal resolution scale
+out vec3 toSun;
+out float coverage;
+#ifdef LOG_DEPTH_COEFFICIENT
+out float logDepth;
+#endif
+void main() {
+    vec4 eyePosition = view * vec4(instance.xyz, 1.0);
+    float diameter = 2.0 * instance.w * projectionScale * sizeScale / max(length(eyePosition.xyz), 1e-3);
+    gl_PointSize = max(diameter, 1.0);
+    coverage = min(diameter * diameter, 1.0);
+    toSun = normalize(sunPosition.xyz - eyePosition.xyz);
+    gl_Position = projection * eyePosition;
+#ifdef LOG_DEPTH_COEFFICIENT
+    logDepth = 1.0 + gl_Position.w;
+#endif
+}
+)";
+
+const char* BODY_FIELD_POINT_FRAGMENT_SHADER = R"(
+#version 430 compatibility
+uniform vec3 albedo;
+in vec3 toSun;
+in float coverage;
+#ifdef LOG_DEPTH_COEFFICIENT
+in float logDepth;
+#endif
+out vec4 fragColor;
+void main() {
+#ifdef LOG_DEPTH_COEFFICIENT
+    gl_FragDepth = log2(logDepth) * LOG_DEPTH_COEFFICIENT;
+#endif
+    vec2 offset = vec2(gl_PointCoord.x, 1.0 - gl_PointCoord.y) * 2.0 - 1.0;
+    float r2 = dot(offset, offset);
+    if (r2 > 1.0) discard;
+    vec3 normal = vec3(offset, sqrt(1.0 - r2)); // Facing the eye, near enough for a few pixels
+    float diffuse = max(dot(normal, toSun), 0.0);
+    fragColor = vec4(albedo * (0.04 + 0.8 * diffuse), coverage);
+}
+)";
+
+// A belt of small bodies between the planet's orbit and the edge of the zoomed-out view, on
+// mildly eccentric and inclined orbits. Mean motion falls off with the semi-major axis as in
+// Kepler's third law, matched to the planet's orbit. Generated in chunks across the job
+// system, each from its own fixed seed, so the field is the same every run at any thread count.
+std::vector<SmallBodyOrbit> generateSmallBodies(int count) {
+    const double planetMeanMotion = PLANET_ORBIT_SPEED * M_PI / 180.0;
+
+    std::vector<SmallBodyOrbit> orbits(count);
+    parallelFor(orbits.size(), BODY_FIELD_GENERATE_GRAIN, [&](size_t begin, size_t end) {
+        std::mt19937 random(12345 + (unsigned)(begin / BODY_FIELD_GENERATE_GRAIN));
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        for (size_t i = begin; i < end; ++i) {
+            OrbitalElements elements = {};
+            elements.semiMajorAxis = 30.0 + 30.0 * unit(random);
+            elements.eccentricity = 0.15 * unit(random) * unit(random);
+            elements.inclination = (unit(random) - 0.5) * 0.2;
+            elements.ascendingNode = 2.0 * M_PI * unit(random);
+            elements.argumentOfPeriapsis = 2.0 * M_PI * unit(random);
+            elements.meanAnomalyAtEpoch = 2.0 * M_PI * unit(random);
+            elements.meanMotion = planetMeanMotion * pow(PLANET_ORBIT_RADIUS / elements.semiMajorAxis, 1.5);
+            double size = unit(random);
+
+            double periapsisAxis[3], normalAxis[3];
+            orbitAxes(elements, periapsisAxis, normalAxis);
+            SmallBodyOrbit& orbit = orbits[i];
+            for (int axis = 0; axis < 3; ++axis) {
+                orbit.periapsisAxis[axis] = (float)periapsisAxis[axis];
+                orbit.normalAxis[axis] = (float)normalAxis[axis];
+            }
+            orbit.eccentricity = (float)elements.eccentricity;
+            orbit.meanAnomalyAtZero = (float)elements.meanAnomalyAtEpoch;
+            orbit.meanMotion = (float)elements.meanMotion;
+            orbit.bodyRadius = (float)(0.05 + 0.25 * size * size * size); // Mostly small, a few large
+            orbit.pad0 = orbit.pad1 = 0.0f;
+        }
+    });
+    return orbits;
+}
+
+// Upload the static orbit data, the LOD meshes and the culling/drawing programs
+void initBodyField(const std::vector<SmallBodyOrbit>& orbits, GLuint texture) {
+    bodyField.cullProgram = createComputeProgram("body_field_cull", BODY_FIELD_CULL_SHADER);
+    bodyField.drawProgram = createProgram("body_field", BODY_FIELD_VERTEX_SHADER, BODY_FIELD_FRAGMENT_SHADER);
+    bodyField.pointProgram = createProgram("body_field_points", BODY_FIELD_POINT_VERTEX_SHADER, BODY_FIELD_POINT_FRAGMENT_SHADER);
+    if (!bodyField.cullProgram || !bodyField.drawProgram || !bodyField.pointProgram) {
+        releaseBodyField();
+        return;
+    }
+    glUniformBlockBinding(bodyField.drawProgram, glGetUniformBlockIndex(bodyField.drawProgram, "FrameUniforms"), FRAME_UNIFORM_BINDING);
+    glUseProgram(bodyField.drawProgram);
+    glUniform1i(glGetUniformLocation(bodyField.drawProgram, "surfaceTexture"), 0);
+    glUniformBlockBinding(bodyField.pointProgram, glGetUniformBlockIndex(bodyField.pointProgram, "FrameUniforms"), FRAME_UNIFORM_BINDING);
+    glUseProgram(bodyField.pointProgram);
+    glUniform3f(glGetUniformLocation(bodyField.pointProgram, "albedo"), BODY_FIELD_POINT_ALBEDO[0], BODY_FIELD_POINT_ALBEDO[1], BODY_FIELD_POINT_ALBEDO[2]);
+    glUseProgram(0);
+
+    // All LODs of the unit sphere share one vertex and one index buffer
+    std::vector<float> vertices;    // position, normal, uv
+    std::vector<GLuint> indices;
+    for (int lod = 0; lod < BODY_FIELD_LOD_COUNT; ++lod) {
+        int slices = BODY_FIELD_LOD_SLICES[lod], stacks = BODY_FIELD_LOD_STACKS[lod];
+        GLuint baseVertex = (GLuint)(vertices.size() / 8);
+        bodyField.commandTemplate[lod].firstIndex = (GLuint)indices.size();
+        bodyField.commandTemplate[lod].baseVertex = (GLint)baseVertex;
+
+        for (int i = 0; i <= stacks; ++i) {
+            float theta = (float)M_PI * i / stacks;
+            for (int j = 0; j <= slices; ++j) {
+                float phi = 2.0f * (float)M_PI * j / slices;
+                float x = sinf(theta) * cosf(phi), y = cosf(theta), z = sinf(theta) * sinf(phi);
+                float vertex[8] = { x, y, z, x, y, z, (float)j / slices, 1.0f - (float)i / stacks };
+                vertices.insert(vertices.end(), vertex, vertex + 8);
+            }
+        }
+        for (int i = 0; i < stacks; ++i) {
+            for (int j = 0; j < slices; ++j) {
+                GLuint a = i * (slices + 1) + j, b = a + slices + 1;
+                GLuint quad[6] = { a, a + 1, b, a + 1, b + 1, b }; // Counter-clockwise from outside
+                indices.insert(indices.end(), quad, quad + 6);
+            }
+        }
+        bodyField.commandTemplate[lod].count = (GLuint)indices.size() - bodyField.commandTemplate[lod].firstIndex;
+        bodyField.commandTemplate[lod].instanceCount = 0;
+        bodyField.commandTemplate[lod].baseInstance = (GLuint)(lod * orbits.size());
+    }
+
+    bodyField.bodyCount = (int)orbits.size();
+    bodyField.texture = texture;
+
+    glGenBuffers(1, &bodyField.meshVertices);
+    glBindBuffer(GL_ARRAY_BUFFER, bodyField.meshVertices);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &bodyField.orbitBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bodyField.orbitBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, orbits.size() * sizeof(SmallBodyOrbit), orbits.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &bodyField.boundsBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bodyField.boundsBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, orbits.size() * 4 * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+
+    glGenBuffers(1, &bodyField.instanceBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bodyField.instanceBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (BODY_FIELD_LOD_COUNT + 1) * orbits.size() * 4 * sizeof(float), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glGenBuffers(1, &bodyField.commandBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, bodyField.commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(bodyField.commandTemplate), bodyField.commandTemplate, GL_DYNAMIC_DRAW);
+    DrawArraysIndirectCommand pointCommand = { 0, 1, 0, 0 };
+    glGenBuffers(1, &bodyField.pointCommandBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, bodyField.pointCommandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(pointCommand), &pointCommand, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    // Vertex layout: mesh attributes per vertex, body centre/radius per instance
+    glGenVertexArrays(1, &bodyField.vertexArray);
+    glBindVertexArray(bodyField.vertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, bodyField.meshVertices);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
+    glBindBuffer(GL_ARRAY_BUFFER, bodyField.instanceBuffer);
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+    glVertexAttribDivisor(3, 1);
+    glGenBuffers(1, &bodyField.meshIndices);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bodyField.meshIndices);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+
+    // Point sprites: the range after the mesh LODs, one vertex per body
+    glGenVertexArrays(1, &bodyField.pointVertexArray);
+    glBindVertexArray(bodyField.pointVertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, bodyField.instanceBuffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(BODY_FIELD_LOD_COUNT * orbits.size() * 4 * sizeof(float)));
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void releaseBodyField() {
+    if (!glDeleteProgram) return;
+    glDeleteProgram(bodyField.cullProgram);
+    glDeleteProgram(bodyField.drawProgram);
+    glDeleteProgram(bodyField.pointProgram);
+    if (bodyField.vertexArray) glDeleteVertexArrays(1, &bodyField.vertexArray);
+    if (bodyField.pointVertexArray) glDeleteVertexArrays(1, &bodyField.pointVertexArray);
+    GLuint buffers[7] = { bodyField.meshVertices, bodyField.meshIndices, bodyField.orbitBuffer,
+        bodyField.boundsBuffer, bodyField.instanceBuffer, bodyField.commandBuffer, bodyField.pointCommandBuffer };
+    glDeleteBuffers(7, buffers);
+    bodyField = BodyField();
+}
+
+// Cull on the GPU, then draw every LOD with a single indirect call
+void renderBodyField(const SceneSnapshot& snapshot, const Mat4& view, const Mat4& projection) {
+    gpuProfiler.begin(GPU_PASS_BODIES);
+
+    // Frustum planes from the combined matrix (Gribb & Hartmann), normalized so that
+    // plane distances are in world units and can be compared against body radii. With the
+    // reverse-Z projection the near/far pair becomes the near plane plus a looser copy of it.
+    Mat4 viewProjection = projection * view;
+    const float* m = viewProjection.m;
+    float planes[6][4];
+    for (int i = 0; i < 3; ++i) {
+        for (int k = 0; k < 4; ++k) {
+            planes[i * 2][k] = m[k * 4 + 3] + m[k * 4 + i];
+            planes[i * 2 + 1][k] = m[k * 4 + 3] - m[k * 4 + i];
+        }
+    }
+    for (int i = 0; i < 6; ++i) {
+        float length = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+        for (int k = 0; k < 4; ++k) planes[i][k] /= length;
+    }
+
+    // N-body asteroids: take the newest step's positions in place of the orbit evaluation
+    if (bodyField.cpuPositions && nbodyPositions.acquire()) {
+        const std::vector<float>& positions = nbodyPositions.readBuffer();
+        size_t floats = std::min(positions.size(), (size_t)bodyField.bodyCount * 4);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, bodyField.boundsBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, floats * sizeof(float), positions.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // Reset the per-LOD instance counts and the point count
+    DrawArraysIndirectCommand pointCommand = { 0, 1, 0, 0 };
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, bodyField.pointCommandBuffer);
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(pointCommand), &pointCommand);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, bodyField.commandBuffer);
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(bodyField.commandTemplate), bodyField.commandTemplate);
+
+    GLuint program = bodyField.cullProgram;
+    glUseProgram(program);
+    glUniform1ui(glGetUniformLocation(program, "bodyCount"), (GLuint)bodyField.bodyCount);
+    glUniform1i(glGetUniformLocation(program, "evaluateOrbits"), bodyField.cpuPositions ? 0 : 1);
+    glUniform1d(glGetUniformLocation(program, "simTime"), snapshot.simTime);
+    glUniform4fv(glGetUniformLocation(program, "frustumPlanes"), 6, &planes[0][0]);
+    glUniform3f(glGetUniformLocation(program, "cameraPosition"), (float)snapshot.cameraEye[0], (float)snapshot.cameraEye[1], (float)snapshot.cameraEye[2]);
+    glUniform1f(glGetUniformLocation(program, "projectionScale"), projection.m[5] * SCREEN_HEIGHT * 0.5f);
+    glUniform1f(glGetUniformLocation(program, "minPixelRadius"), BODY_FIELD_MIN_PIXEL_RADIUS);
+    glUniform1fv(glGetUniformLocation(program, "lodPixelRadius"), BODY_FIELD_LOD_COUNT - 1, BODY_FIELD_LOD_PIXEL_RADIUS);
+    glUniform1f(glGetUniformLocation(program, "pointPixelRadius"), BODY_FIELD_POINT_PIXEL_RADIUS);
+    glUniform1ui(glGetUniformLocation(program, "pointBase"), (GLuint)(BODY_FIELD_LOD_COUNT * bodyField.bodyCount));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, bodyField.orbitBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, bodyField.boundsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, bodyField.instanceBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, bodyField.commandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, bodyField.pointCommandBuffer);
+    glDispatchCompute((bodyField.bodyCount + BODY_FIELD_WORKGROUP_SIZE - 1) / BODY_FIELD_WORKGROUP_SIZE, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+    glUseProgram(bodyField.drawProgram);
+    glBindTexture(GL_TEXTURE_2D, bodyField.texture);
+    glBindVertexArray(bodyField.vertexArray);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, BODY_FIELD_LOD_COUNT, 0);
+
+    // Then the sprites, blended by coverage and without depth writes
+    glUseProgram(bodyField.pointProgram);
+    glUniform1f(glGetUniformLocation(bodyField.pointProgram, "projectionScale"), projection.m[5] * SCREEN_HEIGHT * 0.5f);
+    glUniform1f(glGetUniformLocation(bodyField.pointProgram, "sizeScale"), (float)renderWidth / SCREEN_WIDTH);
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    glEnable(GL_POINT_SPRITE); // Compatibility contexts only fill gl_PointCoord with this on
+    glDepthMask(GL_FALSE);
+    glBindVertexArray(bodyField.pointVertexArray);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, bodyField.pointCommandBuffer);
+    glDrawArraysIndirect(GL_POINTS, nullptr);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_POINT_SPRITE);
+    glDisable(GL_PROGRAM_POINT_SIZE);
+    glBindVertexArray(0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    gpuProfiler.end(GPU_PASS_BODIES);
+}
+
+// Spread the low bits of v so two zero bits separate each, for interleaving into a Morton code
+Uint64 spreadMortonBits(Uint64 v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8) & 0x100f00f00f00f00fULL;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2) & 0x1249249249249249ULL;
+    return v;
+}
+
+// Mass and centre of mass of a node, from its children or, for a leaf, its bodies
+void summarizeOctreeNode(const NBodySystem& system, std::vector<OctreeNode>& pool, int index) {
+    OctreeNode& node = pool[index];
+    double mass = 0.0, moment[3] = {};
+    if (node.firstChild < 0) {
+        for (int k = node.firstBody; k < node.firstBody + node.bodyCount; ++k) {
+            mass += system.sortedMass[k];
+            moment[0] += system.sortedMass[k] * system.sortedX[k];
+            moment[1] += system.sortedMass[k] * system.sortedY[k];
+            moment[2] += system.sortedMass[k] * system.sortedZ[k];
+        }
+    }
+    else {
+        for (int c = node.firstChild; c < node.firstChild + node.childCount; ++c) {
+            const OctreeNode& child = pool[c];
+            mass += child.mass;
+            for (int axis = 0; axis < 3; ++axis) moment[axis] += child.mass * child.centerOfMass[axis];
+        }
+    }
+    node.mass = mass;
+    for (int axis = 0; axis < 3; ++axis) node.centerOfMass[axis] = mass > 0.0 ? moment[axis] / mass : 0.0;
+}
+
+// Fill pool[index] from the sorted bodies [begin, end) at depth, creating its children. With
+// pending set, nodes reaching NBODY_PARALLEL_DEPTH are only recorded, for buildOctree to build
+// in parallel, and nothing is summarized; without it the subtree is built and summarized.
+void buildOctreeNode(NBodySystem& system, std::vector<OctreeNode>& pool, int index, int begin, int end, int depth,
+    std::vector<int>* pending)
+{
+    OctreeNode node = {};
+    node.size = system.boundsSize / (double)(1 << depth);
+    node.firstChild = -1;
+    node.firstBody = begin;
+    node.bodyCount = end - begin;
+    bool split = end - begin > NBODY_LEAF_SIZE && depth < NBODY_MORTON_BITS;
+    if (split && pending && depth == NBODY_PARALLEL_DEPTH) {
+        pool[index] = node;
+        pending->push_back(index);
+        return;
+    }
+
+    if (split) {
+        // Bodies in a node share its Morton prefix, so each child's bodies are a run sorted by the next octal digit
+        int shift = NBODY_INDEX_BITS + 3 * (NBODY_MORTON_BITS - 1 - depth);
+        int ranges[9];
+        ranges[0] = begin;
+        for (int digit = 1; digit < 8; ++digit) {
+            ranges[digit] = (int)(std::partition_point(system.keys.begin() + ranges[digit - 1], system.keys.begin() + end,
+                [&](Uint64 key) { return (int)((key >> shift) & 7) < digit; }) - system.keys.begin());
+        }
+        ranges[8] = end;
+
+        int children = 0;
+        for (int digit = 0; digit < 8; ++digit) children += ranges[digit + 1] > ranges[digit];
+        node.firstChild = (int)pool.size();
+        node.childCount = children;
+        pool.resize(pool.size() + children);
+        int slot = node.firstChild;
+        for (int digit = 0; digit < 8; ++digit) {
+            if (ranges[digit + 1] > ranges[digit]) {
+                buildOctreeNode(system, pool, slot++, ranges[digit], ranges[digit + 1], depth + 1, pending);
+            }
+        }
+    }
+    pool[index] = node;
+    if (!pending) summarizeOctreeNode(system, pool, index);
+}
+
+// Rebuild the tree: Morton keys and their sort in parallel, the top levels serially, then the
+// subtrees below NBODY_PARALLEL_DEPTH in parallel into their own pools, spliced in at the end.
+void buildOctree(NBodySystem& system) {
+    size_t count = system.count;
+    double low[3] = { system.x[0], system.y[0], system.z[0] }, high[3] = { low[0], low[1], low[2] };
+    for (size_t i = 1; i < count; ++i) {
+        low[0] = std::min(low[0], system.x[i]); high[0] = std::max(high[0], system.x[i]);
+        low[1] = std::min(low[1], system.y[i]); high[1] = std::max(high[1], system.y[i]);
+        low[2] = std::min(low[2], system.z[i]); high[2] = std::max(high[2], system.z[i]);
+    }
+    double size = std::max(std::max(high[0] - low[0], high[1] - low[1]), high[2] - low[2]);
+    system.boundsSize = size * 1.0001 + 1e-9; // Keep the far faces inside the last cell
+    memcpy(system.boundsMin, low, sizeof(low));
+
+    const Uint64 cells = (Uint64)1 << NBODY_MORTON_BITS;
+    double scale = (double)cells / system.boundsSize;
+    parallelFor(count, NBODY_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            Uint64 qx = std::min((Uint64)((system.x[i] - low[0]) * scale), cells - 1);
+            Uint64 qy = std::min((Uint64)((system.y[i] - low[1]) * scale), cells - 1);
+            Uint64 qz = std::min((Uint64)((system.z[i] - low[2]) * scale), cells - 1);
+            Uint64 morton = spreadMortonBits(qx) | (spreadMortonBits(qy) << 1) | (spreadMortonBits(qz) << 2);
+            system.keys[i] = (morton << NBODY_INDEX_BITS) | (Uint64)i;
+        }
+    });
+
+    // Sort: one run per thread, then pairwise merges of runs, each round in parallel
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t run = std::max((size_t)NBODY_GRAIN, (count + threads - 1) / threads);
+    parallelFor(count, run, [&](size_t begin, size_t end) {
+        std::sort(system.keys.begin() + begin, system.keys.begin() + end);
+    });
+    for (size_t width = run; width < count; width *= 2) {
+        parallelFor((count + 2 * width - 1) / (2 * width), 1, [&](size_t begin, size_t end) {
+            for (size_t pair = begin; pair < end; ++pair) {
+                size_t first = pair * 2 * width;
+                size_t middle = std::min(first + width, count), last = std::min(first + 2 * width, count);
+                std::inplace_merge(system.keys.begin() + first, system.keys.begin() + middle, system.keys.begin() + last);
+            }
+        });
+    }
+    const Uint64 indexMask = ((Uint64)1 << NBODY_INDEX_BITS) - 1;
+    parallelFor(count, NBODY_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            int body = (int)(system.keys[k] & indexMask);
+            system.order[k] = body;
+            system.sortedX[k] = system.x[body];
+            system.sortedY[k] = system.y[body];
+            system.sortedZ[k] = system.z[body];
+            system.sortedMass[k] = system.mass[body];
+        }
+    });
+
+    system.nodes.assign(1, OctreeNode());
+    std::vector<int> pending;
+    buildOctreeNode(system, system.nodes, 0, 0, (int)count, 0, &pending);
+    int topCount = (int)system.nodes.size();
+
+    std::vector<std::vector<OctreeNode>> pools(pending.size());
+    parallelFor(pending.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            const OctreeNode& top = system.nodes[pending[k]];
+            pools[k].resize(1);
+            buildOctreeNode(system, pools[k], 0, top.firstBody, top.firstBody + top.bodyCount, NBODY_PARALLEL_DEPTH, nullptr);
+        }
+    });
+
+    // Splice each pool in: its root replaces the pending node, the rest is appended
+    for (size_t k = 0; k < pending.size(); ++k) {
+        int offset = (int)system.nodes.size() - 1;
+        for (OctreeNode& node : pools[k]) {
+            if (node.firstChild >= 0) node.firstChild += offset;
+        }
+        system.nodes[pending[k]] = pools[k][0];
+        system.nodes.insert(system.nodes.end(), pools[k].begin() + 1, pools[k].end());
+    }
+
+    // Children are always created after their parent, so summarizing the top levels in
+    // reverse order sees every child before its parent
+    for (int i = topCount - 1; i >= 0; --i) {
+        summarizeOctreeNode(system, system.nodes, i);
+    }
+
+    // Force groups: the largest nodes holding at most NBODY_GROUP_SIZE bodies
+    system.groups.clear();
+    std::vector<int> stack(1, 0);
+    while (!stack.empty()) {
+        int index = stack.back();
+        stack.pop_back();
+        const OctreeNode& node = system.nodes[index];
+        if (node.firstChild < 0 || node.bodyCount <= NBODY_GROUP_SIZE) {
+            system.groups.push_back(index);
+        }
+        else {
+            for (int c = node.firstChild; c < node.firstChild + node.childCount; ++c) stack.push_back(c);
+        }
+    }
+}
+
+// Accelerations and potentials for every body from the tree. Each group of nearby bodies
+// walks the tree once: a node far enough from the whole group, where its size over the gap to
+// the group's bounding sphere is below theta, joins the interaction list as one mass at its
+// centre of mass; nearer leaves add their bodies individually. The list is then summed for
+// every body in the group four entries at a time. It holds single-precision offsets from the
+// group's centre, which keeps them small and exact enough for the force; the positions
+// themselves stay in double.
+void computeNBodyForces(NBodySystem& system) {
+    const __m128 softeningSquared = _mm_set1_ps((float)(NBODY_SOFTENING * NBODY_SOFTENING));
+    const __m128 half = _mm_set1_ps(0.5f), threeHalves = _mm_set1_ps(1.5f), zero = _mm_setzero_ps();
+    parallelFor(system.groups.size(), NBODY_GROUP_GRAIN, [&](size_t begin, size_t end) {
+        std::vector<float> listX, listY, listZ, listMass;
+        int stack[8 * NBODY_MORTON_BITS + 8];  // Each level down replaces one entry with at most 8
+        for (size_t l = begin; l < end; ++l) {
+            const OctreeNode& group = system.nodes[system.groups[l]];
+            int first = group.firstBody, last = group.firstBody + group.bodyCount;
+
+            // Bounding sphere of the group's bodies
+            double low[3] = { system.sortedX[first], system.sortedY[first], system.sortedZ[first] };
+            double high[3] = { low[0], low[1], low[2] };
+            for (int k = first + 1; k < last; ++k) {
+                low[0] = std::min(low[0], system.sortedX[k]); high[0] = std::max(high[0], system.sortedX[k]);
+                low[1] = std::min(low[1], system.sortedY[k]); high[1] = std::max(high[1], system.sortedY[k]);
+                low[2] = std::min(low[2], system.sortedZ[k]); high[2] = std::max(high[2], system.sortedZ[k]);
+            }
+            double center[3], radius = 0.0;
+            for (int axis = 0; axis < 3; ++axis) {
+                center[axis] = 0.5 * (low[axis] + high[axis]);
+                radius += 0.25 * (high[axis] - low[axis]) * (high[axis] - low[axis]);
+            }
+            radius = sqrt(radius);
+
+            listX.clear(); listY.clear(); listZ.clear(); listMass.clear();
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0) {
+                const OctreeNode& node = system.nodes[stack[--top]];
+                double dx = node.centerOfMass[0] - center[0], dy = node.centerOfMass[1] - center[1], dz = node.centerOfMass[2] - center[2];
+                double gap = sqrt(dx * dx + dy * dy + dz * dz) - radius;
+                if (gap > 0.0 && node.size < system.theta * gap) {
+                    listX.push_back((float)dx);
+                    listY.push_back((float)dy);
+                    listZ.push_back((float)dz);
+                    listMass.push_back((float)node.mass);
+                }
+                else if (node.firstChild < 0) {
+                    for (int k = node.firstBody; k < node.firstBody + node.bodyCount; ++k) {
+                        listX.push_back((float)(system.sortedX[k] - center[0]));
+                        listY.push_back((float)(system.sortedY[k] - center[1]));
+                        listZ.push_back((float)(system.sortedZ[k] - center[2]));
+                        listMass.push_back((float)system.sortedMass[k]);
+                    }
+                }
+                else {
+                    for (int c = node.firstChild; c < node.firstChild + node.childCount; ++c) stack[top++] = c;
+                }
+            }
+            while (listX.size() % 4) { // Massless padding
+                listX.push_back(0.0f); listY.push_back(0.0f); listZ.push_back(0.0f); listMass.push_back(0.0f);
+            }
+
+            // Each body meets itself in the list at zero separation; that lane is masked out
+            for (int k = first; k < last; ++k) {
+                __m128 px = _mm_set1_ps((float)(system.sortedX[k] - center[0]));
+                __m128 py = _mm_set1_ps((float)(system.sortedY[k] - center[1]));
+                __m128 pz = _mm_set1_ps((float)(system.sortedZ[k] - center[2]));
+                __m128 accelX = zero, accelY = zero, accelZ = zero, potential = zero;
+                for (size_t j = 0; j < listX.size(); j += 4) {
+                    __m128 ex = _mm_sub_ps(_mm_loadu_ps(&listX[j]), px);
+                    __m128 ey = _mm_sub_ps(_mm_loadu_ps(&listY[j]), py);
+                    __m128 ez = _mm_sub_ps(_mm_loadu_ps(&listZ[j]), pz);
+                    __m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey)), _mm_mul_ps(ez, ez));
+                    __m128 self = _mm_cmpeq_ps(distanceSquared, zero);
+                    distanceSquared = _mm_add_ps(distanceSquared, softeningSquared);
+                    __m128 inverse = _mm_rsqrt_ps(distanceSquared); // About 12 bits; one Newton step brings it to ~22
+                    inverse = _mm_mul_ps(inverse, _mm_sub_ps(threeHalves, _mm_mul_ps(_mm_mul_ps(half, distanceSquared), _mm_mul_ps(inverse, inverse))));
+                    __m128 massOverDistance = _mm_andnot_ps(self, _mm_mul_ps(_mm_loadu_ps(&listMass[j]), inverse));
+                    __m128 strength = _mm_mul_ps(massOverDistance, _mm_mul_ps(inverse, inverse));
+                    accelX = _mm_add_ps(accelX, _mm_mul_ps(strength, ex));
+                    accelY = _mm_add_ps(accelY, _mm_mul_ps(strength, ey));
+                    accelZ = _mm_add_ps(accelZ, _mm_mul_ps(strength, ez));
+                    potential = _mm_sub_ps(potential, massOverDistance);
+                }
+                float sums[4][4];
+                _mm_storeu_ps(sums[0], accelX);
+                _mm_storeu_ps(sums[1], accelY);
+                _mm_storeu_ps(sums[2], accelZ);
+                _mm_storeu_ps(sums[3], potential);
+                int body = system.order[k];
+                system.ax[body] = (double)sums[0][0] + sums[0][1] + sums[0][2] + sums[0][3];
+                system.ay[body] = (double)sums[1][0] + sums[1][1] + sums[1][2] + sums[1][3];
+                system.az[body] = (double)sums[2][0] + sums[2][1] + sums[2][2] + sums[2][3];
+                system.potential[body] = (double)sums[3][0] + sums[3][1] + sums[3][2] + sums[3][3];
+            }
+        }
+    });
+}
+
+// Total energy, kinetic plus potential. The potential is the tree's approximation, so the
+// absolute value carries the opening-angle error; its drift over time is what matters.
+double nbodyEnergy(const NBodySystem& system) {
+    double kinetic = 0.0, potential = 0.0;
+    for (size_t i = 0; i < system.count; ++i) {
+        kinetic += 0.5 * system.mass[i] * (system.vx[i] * system.vx[i] + system.vy[i] * system.vy[i] + system.vz[i] * system.vz[i]);
+        potential += 0.5 * system.mass[i] * system.potential[i]; // Each pair is counted from both ends
+    }
+    return kinetic + potential;
+}
+
+// Rebuild the tree and evaluate forces, timing both for the diagnostics
+void updateNBodyForces(NBodySystem& system) {
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 start = SDL_GetPerformanceCounter();
+    buildOctree(system);
+    Uint64 built = SDL_GetPerformanceCounter();
+    computeNBodyForces(system);
+    Uint64 done = SDL_GetPerformanceCounter();
+    system.buildMs += (built - start) * 1000.0 / frequency;
+    system.forceMs += (done - built) * 1000.0 / frequency;
+}
+
+// A sun at the origin and a belt of asteroids on near-circular orbits around it, with the
+// sun given the opposite momentum so the system's centre of mass stays put. The same seed
+// gives the same belt every run.
+void initNBody(NBodySystem& system, int asteroidCount, double theta) {
+    size_t count = (size_t)asteroidCount + 1;
+    if (count > ((size_t)1 << NBODY_INDEX_BITS)) {
+        std::cerr << "N-body mode supports at most " << ((1 << NBODY_INDEX_BITS) - 1) << " asteroids" << std::endl;
+        count = (size_t)1 << NBODY_INDEX_BITS;
+    }
+    system.count = count;
+    system.theta = theta;
+    std::vector<double>* arrays[] = { &system.x, &system.y, &system.z, &system.vx, &system.vy, &system.vz,
+        &system.ax, &system.ay, &system.az, &system.mass, &system.potential };
+    for (std::vector<double>* array : arrays) array->assign(count, 0.0);
+    system.radius.assign(count, 0.0f);
+    system.keys.resize(count);
+    system.order.resize(count);
+    std::vector<double>* sorted[] = { &system.sortedX, &system.sortedY, &system.sortedZ, &system.sortedMass };
+    for (std::vector<double>* array : sorted) array->resize(count);
+
+    std::mt19937 random(2024);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    system.mass[0] = NBODY_SUN_MASS;
+    double asteroidMass = NBODY_BELT_MASS / (double)(count - 1);
+    double momentum[3] = {};
+    for (size_t i = 1; i < count; ++i) {
+        double radius = NBODY_BELT_INNER + (NBODY_BELT_OUTER - NBODY_BELT_INNER) * unit(random);
+        double angle = 2.0 * M_PI * unit(random);
+        double inclination = (unit(random) - 0.5) * 0.2, node = 2.0 * M_PI * unit(random);
+        double speed = sqrt(NBODY_SUN_MASS / radius);
+        double size = unit(random);
+
+        // In the orbital plane, then tilted about X and turned about Y
+        double position[3] = { radius * cos(angle), 0.0, radius * sin(angle) };
+        double velocity[3] = { -speed * sin(angle), 0.0, speed * cos(angle) };
+        double* vectors[2] = { position, velocity };
+        for (double* v : vectors) {
+            double tiltedY = -v[2] * sin(inclination), tiltedZ = v[2] * cos(inclination);
+            double turnedX = v[0] * cos(node) + tiltedZ * sin(node), turnedZ = -v[0] * sin(node) + tiltedZ * cos(node);
+            v[0] = turnedX;
+            v[1] = tiltedY;
+            v[2] = turnedZ;
+        }
+        system.x[i] = position[0]; system.y[i] = position[1]; system.z[i] = position[2];
+        system.vx[i] = velocity[0]; system.vy[i] = velocity[1]; system.vz[i] = velocity[2];
+        system.mass[i] = asteroidMass;
+        system.radius[i] = (float)(0.05 + 0.25 * size * size * size); // Same spread as the small body field
+        for (int axis = 0; axis < 3; ++axis) momentum[axis] += asteroidMass * velocity[axis];
+    }
+    system.vx[0] = -momentum[0] / NBODY_SUN_MASS;
+    system.vy[0] = -momentum[1] / NBODY_SUN_MASS;
+    system.vz[0] = -momentum[2] / NBODY_SUN_MASS;
+
+    updateNBodyForces(system);
+    system.accelerationsValid = true;
+    system.initialEnergy = nbodyEnergy(system);
+    system.buildMs = system.forceMs = 0.0;
+    system.lastReportTicks = SDL_GetPerformanceCounter();
+}
+
+// One kick-drift-kick leapfrog step: symplectic and time-reversible, so energy error stays
+// bounded instead of accumulating the way it does with explicit Euler
+void stepNBody(NBodySystem& system, double dt) {
+    if (!system.accelerationsValid) {
+        updateNBodyForces(system);
+        system.accelerationsValid = true;
+    }
+    double half = 0.5 * dt;
+    parallelFor(system.count, NBODY_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            system.vx[i] += system.ax[i] * half;
+            system.vy[i] += system.ay[i] * half;
+            system.vz[i] += system.az[i] * half;
+            system.x[i] += system.vx[i] * dt;
+            system.y[i] += system.vy[i] * dt;
+            system.z[i] += system.vz[i] * dt;
+        }
+    });
+    updateNBodyForces(system);
+
+    // Second kick, noting the largest acceleration for the next substep length
+    system.chunkMaxAcceleration.assign((system.count + NBODY_GRAIN - 1) / NBODY_GRAIN, 0.0);
+    parallelFor(system.count, NBODY_GRAIN, [&](size_t begin, size_t end) {
+        double largest = 0.0;
+        for (size_t i = begin; i < end; ++i) {
+            system.vx[i] += system.ax[i] * half;
+            system.vy[i] += system.ay[i] * half;
+            system.vz[i] += system.az[i] * half;
+            largest = std::max(largest, system.ax[i] * system.ax[i] + system.ay[i] * system.ay[i] + system.az[i] * system.az[i]);
+        }
+        system.chunkMaxAcceleration[begin / NBODY_GRAIN] = largest;
+    });
+    double largest = *std::max_element(system.chunkMaxAcceleration.begin(), system.chunkMaxAcceleration.end());
+    system.stableStep = largest > 0.0 ? std::min(NBODY_MAX_STEP, NBODY_STEP_ACCURACY * sqrt(NBODY_SOFTENING / sqrt(largest))) : NBODY_MAX_STEP;
+    system.time += dt;
+    ++system.stepsSinceReport;
+}
+
+// Advance the belt by dt of simulated time in equal substeps no longer than its stable step,
+// starting no new substep once budgetMs of CPU time is spent; with none left it does nothing.
+// The main loop shares one budget across all the steps of a pass, so the cost per pass stays
+// bounded at any warp. A substepLimit of zero or more runs exactly that many instead, whatever
+// the time, as when a replay repeats what the budget allowed in the recording. Returns the
+// time actually covered, short of dt when the budget clamps a high time warp.
+double advanceNBody(NBodySystem& system, double dt, double budgetMs, int substepLimit) {
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 start = SDL_GetPerformanceCounter();
+    double advanced = 0.0;
+    system.substepsTaken = 0;
+    while (dt - advanced > 1e-12 * dt) {
+        bool spent = substepLimit >= 0 ? system.substepsTaken >= substepLimit
+            : (SDL_GetPerformanceCounter() - start) * 1000.0 / frequency >= budgetMs;
+        if (spent) break;
+        double remaining = dt - advanced;
+        double substep = remaining / ceil(remaining / system.stableStep);
+        stepNBody(system, substep);
+        advanced += substep;
+        ++system.substepsTaken;
+    }
+    system.requestedTime += dt;
+    system.advancedTime += advanced;
+
+    // Diagnostics: per-step cost, energy drift relative to the start, and how much of the
+    // requested warp the budget let through
+    Uint64 now = SDL_GetPerformanceCounter();
+    if ((now - system.lastReportTicks) >= NBODY_REPORT_INTERVAL * frequency && system.stepsSinceReport > 0) {
+        double energy = nbodyEnergy(system);
+        double drift = system.initialEnergy != 0.0 ? fabs((energy - system.initialEnergy) / system.initialEnergy) : 0.0;
+        double realSeconds = (double)(now - system.lastReportTicks) / frequency;
+        char line[240];
+        snprintf(line, sizeof(line), "N-body: %d bodies, t = %.0f s, tree %.2f ms, forces %.2f ms per step, energy drift %.2e, substep %.3g s",
+            (int)system.count, system.time, system.buildMs / system.stepsSinceReport, system.forceMs / system.stepsSinceReport, drift, system.stableStep);
+        std::cout << line;
+        if (system.advancedTime < system.requestedTime * (1.0 - 1e-9)) {
+            snprintf(line, sizeof(line), ", budget-limited to %.3gx of %.3gx warp",
+                system.advancedTime / realSeconds, system.requestedTime / realSeconds);
+            std::cout << line;
+        }
+        std::cout << std::endl;
+        system.lastReportTicks = now;
+        system.buildMs = system.forceMs = 0.0;
+        system.stepsSinceReport = 0;
+        system.requestedTime = system.advancedTime = 0.0;
+    }
+    return advanced;
+}
+
+// FNV-1a over the simulated and camera state, so two runs of a session can be checked for
+// having ended in exactly the same place
+Uint64 sessionFingerprint(const BodyStore& bodies, const SceneFocus& focus, const NBodySystem& nbody, double simTime) {
+    Uint64 hash = 14695981039346656037ull;
+    auto mix = [&hash](const void* data, size_t size) {
+        const unsigned char* bytes = (const unsigned char*)data;
+        for (size_t i = 0; i < size; ++i) hash = (hash ^ bytes[i]) * 1099511628211ull;
+    };
+    mix(&simTime, sizeof(simTime));
+    mix(&timeWarp.rate, sizeof(timeWarp.rate));
+    mix(bodies.positionX.data(), bodies.count * sizeof(double));
+    mix(bodies.positionY.data(), bodies.count * sizeof(double));
+    mix(bodies.positionZ.data(), bodies.count * sizeof(double));
+    mix(bodies.spinAngle.data(), bodies.count * sizeof(float));
+    mix(&focus.zoom, sizeof(focus.zoom));
+    mix(&focus.userRotationX, sizeof(focus.userRotationX));
+    mix(&focus.userRotationY, sizeof(focus.userRotationY));
+    mix(nbody.x.data(), nbody.count * sizeof(double));
+    mix(nbody.y.data(), nbody.count * sizeof(double));
+    mix(nbody.z.data(), nbody.count * sizeof(double));
+    return hash;
+}
+
+// Hand the newest asteroid positions to the render thread. The sun is drawn separately.
+void publishNBodyPositions(const NBodySystem& system) {
+    std::vector<float>& positions = nbodyPositions.writeBuffer();
+    positions.resize((system.count - 1) * 4);
+    for (size_t i = 1; i < system.count; ++i) {
+        float* body = &positions[(i - 1) * 4];
+        body[0] = (float)system.x[i];
+        body[1] = (float)system.y[i];
+        body[2] = (float)system.z[i];
+        body[3] = system.radius[i];
+    }
+    nbodyPositions.publish();
+}
+
+// Camera distance for the precision test: a logarithmic sweep from high orbit down to just
+// above the surface and back, so every scale from 1 AU to metres is visited each period
+float precisionTestZoom(double simTime, float planetRadius) {
+    double phase = fmod(simTime / PRECISION_TEST_ZOOM_PERIOD, 1.0);
+    double t = phase < 0.5 ? phase * 2.0 : 2.0 - phase * 2.0;
+    double altitude = exp(log(PRECISION_TEST_MAX_ALTITUDE) * (1.0 - t) + log(PRECISION_TEST_MIN_ALTITUDE) * t);
+    double zoom = planetRadius * (1.0 + altitude);
+    if (depthMode == DEPTH_CONVENTIONAL) zoom = std::max(zoom, (double)MIN_ZOOM); // Near plane at 1.0
+    return (float)zoom;
+}
+
+// Approximate color of a star from its B-V index: B-V to temperature (Ballesteros 2012), then
+// temperature to sRGB with Tanner Helland's blackbody fit. Packed RGBA8, red in the low byte.
+Uint32 starColor(double bv) {
+    bv = std::min(std::max(bv, -0.4), 2.0);
+    double kelvin = 4600.0 * (1.0 / (0.92 * bv + 1.7) + 1.0 / (0.92 * bv + 0.62)) / 100.0;
+    double r, g, b;
+    if (kelvin <= 66.0) {
+        r = 255.0;
+        g = 99.4708025861 * log(kelvin) - 161.1195681661;
+        b = kelvin <= 19.0 ? 0.0 : 138.5177312231 * log(kelvin - 10.0) - 305.0447927307;
+    }
+    else {
+        r = 329.698727446 * pow(kelvin - 60.0, -0.1332047592);
+        g = 288.1221695283 * pow(kelvin - 60.0, -0.0755148492);
+        b = 255.0;
+    }
+    Uint32 red = (Uint32)std::min(std::max(r, 0.0), 255.0);
+    Uint32 green = (Uint32)std::min(std::max(g, 0.0), 255.0);
+    Uint32 blue = (Uint32)std::min(std::max(b, 0.0), 255.0);
+    return red | (green << 8) | (blue << 16) | (255u << 24);
+}
+
+// Turn a plain-text catalog into the binary layout initStarField maps. One star per line:
+// right ascension and declination in degrees (J2000), visual magnitude and, optionally, the
+// B-V color index. '#' starts a comment. Returns the process exit code.
+int convertStarCatalog(const char* textPath, const char* binaryPath) {
+    FILE* input = fopen(textPath, "r");
+    if (!input) {
+        std::cerr << "Could not open star catalog " << textPath << std::endl;
+        return 1;
+    }
+
+    const double obliquity = 23.4392911 * M_PI / 180.0; // J2000 mean obliquity of the ecliptic
+    std::vector<StarRecord> stars;
+    char line[512];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), input)) {
+        ++lineNumber;
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        double rightAscension, declination, magnitude, bv = 0.65; // Sun-like when the index is missing
+        int fields = sscanf(line, "%lf %lf %lf %lf", &rightAscension, &declination, &magnitude, &bv);
+        if (fields <= 0) continue; // Blank or comment-only line
+        if (fields < 3) {
+            std::cerr << textPath << ":" << lineNumber << ": expected RA, Dec and magnitude, skipping" << std::endl;
+            continue;
+        }
+
+        // Equatorial unit vector, tilted about the equinox direction into ecliptic coordinates
+        double ra = rightAscension * M_PI / 180.0, dec = declination * M_PI / 180.0;
+        double x = cos(dec) * cos(ra), y = cos(dec) * sin(ra), z = sin(dec);
+        double eclipticY = y * cos(obliquity) + z * sin(obliquity);
+        double eclipticZ = -y * sin(obliquity) + z * cos(obliquity);
+
+        // Scene axes: X is the equinox and the planet orbits in the XZ plane from X towards Z,
+        // which is prograde about -Y, so the ecliptic north pole maps to -Y
+        StarRecord star;
+        star.direction[0] = (float)x;
+        star.direction[1] = (float)-eclipticZ;
+        star.direction[2] = (float)eclipticY;
+        star.magnitude = (float)magnitude;
+        star.color = starColor(bv);
+        stars.push_back(star);
+    }
+    fclose(input);
+
+    std::sort(stars.begin(), stars.end(), [](const StarRecord& a, const StarRecord& b) { return a.magnitude < b.magnitude; });
+
+    StarCatalogHeader header;
+    memcpy(header.magic, STAR_CATALOG_MAGIC, sizeof(header.magic));
+    header.version = STAR_CATALOG_VERSION;
+    header.count = (Uint32)stars.size();
+    header.recordSize = sizeof(StarRecord);
+
+    FILE* output = fopen(binaryPath, "wb");
+    bool written = output
+        && fwrite(&header, sizeof(header), 1, output) == 1
+        && fwrite(stars.data(), sizeof(StarRecord), stars.size(), output) == stars.size();
+    if (output) written = fclose(output) == 0 && written;
+    if (!written) {
+        std::cerr << "Could not write star catalog " << binaryPath << std::endl;
+        return 1;
+    }
+    std::cout << "Wrote " << stars.size() << " stars to " << binaryPath << std::endl;
+    return 0;
+}
+
+// Stars live at infinity, so only the view rotation applies. Each sprite's size follows its
+// brightness until it clamps, and the brightness is rescaled to keep its total energy.
+const char* STAR_VERTEX_SHADER = R"(
+#version 330 compatibility
+layout(location = 0) in vec3 direction;
+layout(location = 1) in float magnitude;
+layout(location = 2) in vec4 color;
+uniform mat4 skyTransform;      // Projection times view rotation
+uniform float referenceMagnitude;
+uniform float baseSize;         // Sprite diameter in pixels at the reference magnitude
+uniform float maxSize;
+uniform float intensity;
+uniform float sizeScale;        // Internal resolution scale, so stars keep their on-screen size
+out vec3 starColor;
+void main() {
+    gl_Position = skyTransform * vec4(direction, 0.0);
+    gl_Position.z = 0.0;    // Depth testing is off; keep the point clear of the near and far planes
+
+    float flux = exp2(-1.3287712 * (magnitude - referenceMagnitude)); // 10^(-0.4 * difference)
+    float referenceSize = baseSize * sizeScale;
+    float size = clamp(referenceSize * sqrt(flux), 1.0, max(maxSize * sizeScale, 1.0));
+    gl_PointSize = size;
+    starColor = color.rgb * intensity * flux * (referenceSize * referenceSize) / (size * size);
+}
+)";
+
+const char* STAR_FRAGMENT_SHADER = R"(
+#version 330 compatibility
+in vec3 starColor;
+out vec4 fragColor;
+void main() {
+    vec2 offset = gl_PointCoord * 2.0 - 1.0;
+    float falloff = max(1.0 - dot(offset, offset), 0.0);
+    fragColor = vec4(starColor * falloff * falloff, 1.0);
+}
+)";
+
+// Map the binary catalog and upload the stars inside the magnitude limit in one copy. Missing
+// or mismatched catalogs only leave the background black.
+void initStarField(const char* path) {
+    MappedFile catalog;
+    if (!catalog.open(path)) {
+        std::cerr << "Star catalog " << path << " not found, background stays black (build one with --convert-stars)" << std::endl;
+        return;
+    }
+    const StarCatalogHeader* header = (const StarCatalogHeader*)catalog.getData();
+    if (catalog.getSize() < sizeof(StarCatalogHeader) || memcmp(header->magic, STAR_CATALOG_MAGIC, sizeof(header->magic)) != 0
+        || header->version != STAR_CATALOG_VERSION || header->recordSize != sizeof(StarRecord)
+        || catalog.getSize() < sizeof(StarCatalogHeader) + (size_t)header->count * sizeof(StarRecord)) {
+        std::cerr << "Star catalog " << path << " is not a version " << STAR_CATALOG_VERSION << " catalog, ignoring it" << std::endl;
+        return;
+    }
+
+    // Records are sorted brightest first, so everything inside the limit is a prefix
+    const StarRecord* stars = (const StarRecord*)(header + 1);
+    const StarRecord* end = std::partition_point(stars, stars + header->count,
+        [](const StarRecord& star) { return star.magnitude <= STAR_MAGNITUDE_LIMIT; });
+    int count = (int)(end - stars);
+    if (count == 0) return;
+
+    starField.program = createProgram("stars", STAR_VERTEX_SHADER, STAR_FRAGMENT_SHADER);
+    if (!starField.program) return;
+    glUseProgram(starField.program);
+    glUniform1f(glGetUniformLocation(starField.program, "referenceMagnitude"), STAR_REFERENCE_MAGNITUDE);
+    glUniform1f(glGetUniformLocation(starField.program, "baseSize"), STAR_BASE_SIZE);
+    glUniform1f(glGetUniformLocation(starField.program, "maxSize"), STAR_MAX_SIZE);
+    glUniform1f(glGetUniformLocation(starField.program, "intensity"), glCaps.postProcessing ? STAR_INTENSITY : 1.0f);
+    glUseProgram(0);
+
+    glGenBuffers(1, &starField.vertices);
+    glBindBuffer(GL_ARRAY_BUFFER, starField.vertices);
+    glBufferData(GL_ARRAY_BUFFER, count * sizeof(StarRecord), stars, GL_STATIC_DRAW); // Straight from the mapping
+
+    glGenVertexArrays(1, &starField.vertexArray);
+    glBindVertexArray(starField.vertexArray);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(StarRecord), (void*)offsetof(StarRecord, direction));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(StarRecord), (void*)offsetof(StarRecord, magnitude));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(StarRecord), (void*)offsetof(StarRecord, color));
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    starField.drawCount = count;
+}
+
+void releaseStarField() {
+    if (!glDeleteProgram) return;
+    glDeleteProgram(starField.program);
+    if (starField.vertexArray) glDeleteVertexArrays(1, &starField.vertexArray);
+    if (starField.vertices) glDeleteBuffers(1, &starField.vertices);
+    starField = StarField();
+}
+
+// All stars in one additive point draw, before any body
+void renderStarField(const Mat4& projection, const Mat4& viewRotation) {
+    gpuProfiler.begin(GPU_PASS_STARS);
+    Mat4 skyTransform = projection * viewRotation;
+
+    glUseProgram(starField.program);
+    glUniformMatrix4fv(glGetUniformLocation(starField.program, "skyTransform"), 1, GL_FALSE, skyTransform.m);
+    glUniform1f(glGetUniformLocation(starField.program, "sizeScale"), (float)renderWidth / SCREEN_WIDTH);
+    glDisable(GL_DEPTH_TEST);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    glEnable(GL_POINT_SPRITE); // Compatibility contexts only fill gl_PointCoord with this on
+
+    glBindVertexArray(starField.vertexArray);
+    glDrawArrays(GL_POINTS, 0, starField.drawCount);
+    glBindVertexArray(0);
+
+    glDisable(GL_POINT_SPRITE);
+    glDisable(GL_PROGRAM_POINT_SIZE);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glEnable(GL_DEPTH_TEST);
+    gpuProfiler.end(GPU_PASS_STARS);
+}
+
+// Ring debris: small rocks placed in ring space, lit by the sun and dropped into the planet's
+// shadow with a simple cylinder test
+const char* RING_DEBRIS_VERTEX_SHADER = R"(
+#version 330 compatibility
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec4 particle;  // Ring-space centre and size
+layout(std140) uniform FrameUniforms {
+    mat4 projection;
+    mat4 view;
+    vec4 sunPosition;
+};
+uniform mat4 ringModelView;
+out vec3 viewPosition;
+out vec3 viewNormal;
+#ifdef LOG_DEPTH_COEFFICIENT
+out float logDepth;
+#endif
+void main() {
+    // Turn each rock by an angle derived from its position so they don't all line up
+    float angle = particle.x * 37.0 + particle.z * 91.0;
+    float c = cos(angle), s = sin(angle), c2 = cos(angle * 0.7), s2 = sin(angle * 0.7);
+    mat3 spin = mat3(1.0, 0.0, 0.0, 0.0, c2, s2, 0.0, -s2, c2) * mat3(c, 0.0, -s, 0.0, 1.0, 0.0, s, 0.0, c);
+    vec4 eyePosition = ringModelView * vec4(particle.xyz + spin * position * particle.w, 1.0);
+    viewPosition = eyePosition.xyz;
+    viewNormal = mat3(ringModelView) * (spin * normal);
+    gl_Position = projection * eyePosition;
+#ifdef LOG_DEPTH_COEFFICIENT
+    logDepth = 1.0 + gl_Position.w;
+#endif
+}
+)";
+
+const char* RING_DEBRIS_FRAGMENT_SHADER = R"(
+#version 330 compatibility
+layout(std140) uniform FrameUniforms {
+    mat4 projection;
+    mat4 view;
+    vec4 sunPosition;
+};
+uniform vec4 planetSphere;  // View space centre and radius
+in vec3 viewPosition;
+in vec3 viewNormal;
+#ifdef LOG_DEPTH_COEFFICIENT
+in float logDepth;
+#endif
+out vec4 fragColor;
+void main() {
+#ifdef LOG_DEPTH_COEFFICIENT
+    gl_FragDepth = log2(logDepth) * LOG_DEPTH_COEFFICIENT;
+#endif
+    vec3 toSun = normalize(sunPosition.xyz - viewPosition);
+    float diffuse = max(dot(normalize(viewNormal), toSun), 0.0);
+
+    // In the planet's shadow if the planet lies between this point and the sun
+    vec3 toPlanet = planetSphere.xyz - viewPosition;
+    float along = dot(toPlanet, toSun);
+    if (along > 0.0) {
+        float across = length(toPlanet - toSun * along);
+        diffuse *= smoothstep(planetSphere.w * 0.98, planetSphere.w * 1.02, across);
+    }
+    fragColor = vec4(vec3(0.75, 0.72, 0.68) * (0.04 + 0.8 * diffuse), 1.0);
+}
+)";
+
+// Build the annulus mesh and the debris particles for rings between the given radii
+void initRings(float innerRadius, float outerRadius) {
+    ringSystem.innerRadius = innerRadius;
+    ringSystem.outerRadius = outerRadius;
+
+    // Annulus: u runs around the ring, v from the inner to the outer edge
+    std::vector<float> vertices;    // position, normal, uv
+    std::vector<GLuint> indices;
+    for (int band = 0; band <= RING_BANDS; ++band) {
+        float t = (float)band / RING_BANDS;
+        float radius = innerRadius + (outerRadius - innerRadius) * t;
+        for (int segment = 0; segment <= RING_SEGMENTS; ++segment) {
+            float angle = 2.0f * (float)M_PI * segment / RING_SEGMENTS;
+            float vertex[8] = { radius * cosf(angle), 0.0f, radius * sinf(angle), 0.0f, 1.0f, 0.0f,
+                (float)segment / RING_SEGMENTS, t };
+            vertices.insert(vertices.end(), vertex, vertex + 8);
+        }
+    }
+    for (int band = 0; band < RING_BANDS; ++band) {
+        for (int segment = 0; segment < RING_SEGMENTS; ++segment) {
+            GLuint a = band * (RING_SEGMENTS + 1) + segment, b = a + RING_SEGMENTS + 1;
+            GLuint quad[6] = { a, a + 1, b, a + 1, b + 1, b }; // Counter-clockwise seen from +Y
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+    glGenBuffers(1, &ringSystem.annulusVertices);
+    glBindBuffer(GL_ARRAY_BUFFER, ringSystem.annulusVertices);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    glGenBuffers(1, &ringSystem.annulusIndices);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ringSystem.annulusIndices);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    ringSystem.annulusIndexCount = (int)indices.size();
+
+    ringSystem.debrisProgram = createProgram("ring_debris", RING_DEBRIS_VERTEX_SHADER, RING_DEBRIS_FRAGMENT_SHADER);
+    if (!ringSystem.debrisProgram) {
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return; // The annulus still works without debris
+    }
+    glUniformBlockBinding(ringSystem.debrisProgram, glGetUniformBlockIndex(ringSystem.debrisProgram, "FrameUniforms"), FRAME_UNIFORM_BINDING);
+
+    // One rock: a flat-shaded octahedron
+    std::vector<float> rock;    // position, normal
+    for (int face = 0; face < 8; ++face) {
+        float sx = face & 1 ? -1.0f : 1.0f, sy = face & 2 ? -1.0f : 1.0f, sz = face & 4 ? -1.0f : 1.0f;
+        float corners[3][3] = { { sx, 0.0f, 0.0f }, { 0.0f, sy, 0.0f }, { 0.0f, 0.0f, sz } };
+        if (sx * sy * sz < 0.0f) std::swap(corners[1], corners[2]); // Keep the winding outward
+        float n = 1.0f / sqrtf(3.0f);
+        for (int i = 0; i < 3; ++i) {
+            float vertex[6] = { corners[i][0], corners[i][1], corners[i][2], sx * n, sy * n, sz * n };
+            rock.insert(rock.end(), vertex, vertex + 6);
+        }
+    }
+    ringSystem.debrisMeshVertexCount = (int)(rock.size() / 6);
+
+    // Particles, uniform over the annulus area. Each sector's particles are in random order,
+    // so drawing the first N of a sector thins it out evenly.
+    std::mt19937 random(4242); // Fixed seed: the same rings every run
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<float> particles;
+    particles.reserve(RING_DEBRIS_SECTORS * RING_DEBRIS_PER_SECTOR * 4);
+    for (int sector = 0; sector < RING_DEBRIS_SECTORS; ++sector) {
+        for (int i = 0; i < RING_DEBRIS_PER_SECTOR; ++i) {
+            float angle = 2.0f * (float)M_PI * (sector + unit(random)) / RING_DEBRIS_SECTORS;
+            float radius = sqrtf(innerRadius * innerRadius + (outerRadius * outerRadius - innerRadius * innerRadius) * unit(random));
+            float size = unit(random);
+            float particle[4] = { radius * cosf(angle), (unit(random) - 0.5f) * RING_DEBRIS_THICKNESS, radius * sinf(angle),
+                0.002f + 0.008f * size * size * size };
+            particles.insert(particles.end(), particle, particle + 4);
+        }
+    }
+
+    glGenBuffers(1, &ringSystem.debrisMesh);
+    glBindBuffer(GL_ARRAY_BUFFER, ringSystem.debrisMesh);
+    glBufferData(GL_ARRAY_BUFFER, rock.size() * sizeof(float), rock.data(), GL_STATIC_DRAW);
+    glGenBuffers(1, &ringSystem.debrisInstances);
+    glBindBuffer(GL_ARRAY_BUFFER, ringSystem.debrisInstances);
+    glBufferData(GL_ARRAY_BUFFER, particles.size() * sizeof(float), particles.data(), GL_STATIC_DRAW);
+
+    glGenVertexArrays(1, &ringSystem.debrisVertexArray);
+    glBindVertexArray(ringSystem.debrisVertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, ringSystem.debrisMesh);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1); // The pointer itself is set per sector in renderRingDebris
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void releaseRings() {
+    if (!glDeleteProgram) return;
+    glDeleteProgram(ringSystem.debrisProgram);
+    if (ringSystem.debrisVertexArray) glDeleteVertexArrays(1, &ringSystem.debrisVertexArray);
+    GLuint buffers[4] = { ringSystem.annulusVertices, ringSystem.annulusIndices, ringSystem.debrisMesh, ringSystem.debrisInstances };
+    glDeleteBuffers(4, buffers);
+    ringSystem = RingSystem();
+}
+
+// Draw the debris sectors near the camera. Each sector's particle count falls off with its
+// distance, so far sectors cost nothing and the annulus takes over smoothly.
+void renderRingDebris(const PlanetState& planet, const CameraFrame& camera) {
+    Mat4 rings = Planet::ringModelView(planet, camera);
+    const float* m = rings.m;
+
+    // Camera in ring space: the inverse of a rigid transform uses the transposed rotation
+    float eye[3];
+    for (int i = 0; i < 3; ++i) {
+        eye[i] = -(m[i * 4] * m[12] + m[i * 4 + 1] * m[13] + m[i * 4 + 2] * m[14]);
+    }
+
+    // Most frames the camera is nowhere near the rings
+    float eyeRadius = sqrtf(eye[0] * eye[0] + eye[2] * eye[2]);
+    float gap = std::max(std::max(ringSystem.innerRadius - eyeRadius, eyeRadius - ringSystem.outerRadius), 0.0f);
+    if (sqrtf(gap * gap + eye[1] * eye[1]) >= RING_DEBRIS_RANGE) return;
+
+    gpuProfiler.begin(GPU_PASS_DEBRIS);
+    GLuint program = ringSystem.debrisProgram;
+    glUseProgram(program);
+    glUniformMatrix4fv(glGetUniformLocation(program, "ringModelView"), 1, GL_FALSE, m);
+    glUniform4f(glGetUniformLocation(program, "planetSphere"), m[12], m[13], m[14], planet.radius);
+    glBindVertexArray(ringSystem.debrisVertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, ringSystem.debrisInstances);
+
+    float middleRadius = (ringSystem.innerRadius + ringSystem.outerRadius) * 0.5f;
+    float halfWidth = (ringSystem.outerRadius - ringSystem.innerRadius) * 0.5f;
+    float halfArc = ringSystem.outerRadius * (float)M_PI / RING_DEBRIS_SECTORS;
+    float sectorBound = sqrtf(halfWidth * halfWidth + halfArc * halfArc) + RING_DEBRIS_THICKNESS;
+    for (int sector = 0; sector < RING_DEBRIS_SECTORS; ++sector) {
+        float angle = 2.0f * (float)M_PI * (sector + 0.5f) / RING_DEBRIS_SECTORS;
+        float center[3] = { middleRadius * cosf(angle), 0.0f, middleRadius * sinf(angle) };
+        float dx = center[0] - eye[0], dy = center[1] - eye[1], dz = center[2] - eye[2];
+        float distance = sqrtf(dx * dx + dy * dy + dz * dz) - sectorBound;
+        if (distance >= RING_DEBRIS_RANGE) continue;
+        float viewZ = m[2] * center[0] + m[6] * center[1] + m[10] * center[2] + m[14];
+        if (viewZ > sectorBound) continue; // Entirely behind the camera
+
+        float density = 1.0f - std::max(distance, 0.0f) / RING_DEBRIS_RANGE;
+        int count = (int)(density * density * RING_DEBRIS_PER_SECTOR);
+        if (count == 0) continue;
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 0, (void*)(sector * RING_DEBRIS_PER_SECTOR * 4 * sizeof(float)));
+        glDrawArraysInstanced(GL_TRIANGLES, 0, ringSystem.debrisMeshVertexCount, count);
+    }
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    gpuProfiler.end(GPU_PASS_DEBRIS);
+}